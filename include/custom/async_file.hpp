@@ -0,0 +1,436 @@
+/*
+	This library reads and writes many files asynchronously, so that the I/O of the files overlaps instead of going one file at a time.
+	The requests are submitted in batches and the completions are collected in batches, in whatever order they finish.
+
+	On Linux, define FILEUTILITY_USE_IO_URING and link liburing to let a single thread drive all the requests through io_uring, the opens, stats and closes included,
+	so the thread never blocks on a file. If io_uring is not compiled in, or the kernel is older than 5.6 and lacks those operations, a pool of threads does the blocking I/O instead.
+
+	Here goes an example:
+
+	fileutility::async_file_engine engine;
+	for(auto& p : paths)
+		engine.submit_read(p);
+	std::vector<fileutility::file_completion> done;
+	while(engine.wait(done))
+	{
+		for(auto& c : done)
+			process(c.path, c.content);
+		done.clear();
+	}
+*/
+
+#pragma once
+#include <custom/fileutility.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+#include <liburing.h>
+#include <unordered_set>
+#endif
+
+namespace fileutility
+{
+	struct file_completion
+	{
+		uint64_t							id;
+		std::experimental::filesystem::path	path;
+		//The content read, or the content written which is handed back for reuse.
+		vector<char>						content;
+		bool								write;
+		bool								succeeded;
+	};
+
+	class async_file_engine : boost::noncopyable
+	{
+	private:
+		struct request
+		{
+			file_completion	completion;
+			int				handle;
+			size_t			done;
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+			int				stage;		//The operation in the ring, one of stage_type.
+			struct statx	status;
+#endif
+		};
+		boost::mutex						m;
+		boost::condition_variable			requests_ready;
+		boost::condition_variable			completions_ready;
+		std::deque<std::unique_ptr<request>>	requests;
+		vector<file_completion>				completions;
+		uint64_t							submitted;
+		uint64_t							finished;
+		bool								stopping;
+		std::vector<boost::thread>			workers;
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+		io_uring							ring;
+		size_t								depth;
+		bool								ring_ready;
+		size_t								in_kernel;		//The entries taken by the kernel and not completed yet.
+		std::deque<request*>				unsubmitted;	//The requests of the entries queued but not taken by the kernel yet, in the order of the queue.
+		std::unordered_set<std::string>		directories;	//The parents of the written files known to exist.
+#endif
+
+		uint64_t submit(std::unique_ptr<request> r)
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			r->completion.id = ++submitted;
+			auto id = r->completion.id;
+			requests.push_back(std::move(r));
+			requests_ready.notify_one();
+			return id;
+		}
+		void complete(vector<file_completion>& batch)
+		{
+			if(batch.empty()) return;
+			boost::lock_guard<boost::mutex> lock(m);
+			for(auto& c : batch)
+				completions.push_back(std::move(c));
+			finished += batch.size();
+			batch.clear();
+			completions_ready.notify_all();
+		}
+		//Takes up to limit requests, blocks while there is none, returns false once stopping and drained.
+		//The workers take their fair share only, so that a few large files are still spread over all of them.
+		bool take(std::vector<std::unique_ptr<request>>& batch, size_t limit, bool block, bool share = false)
+		{
+			boost::unique_lock<boost::mutex> lock(m);
+			while(block && requests.empty() && false == stopping)
+				requests_ready.wait(lock);
+			if(share)
+				limit = (std::min)(limit, (std::max)((size_t)1, requests.size() / workers.size()));
+			while(false == requests.empty() && batch.size() < limit)
+			{
+				batch.push_back(std::move(requests.front()));
+				requests.pop_front();
+			}
+			return false == (stopping && requests.empty() && batch.empty());
+		}
+
+		//The blocking path, shared by the worker threads.
+		static void execute(request& r)
+		{
+			auto& c = r.completion;
+			native_file file;
+			if(c.write)
+			{
+				std::error_code ec;
+				std::experimental::filesystem::create_directories(c.path.parent_path(), ec);
+				c.succeeded = file.open(c.path, native_file::open_write) && file.write(c.content.data(), c.content.size());
+				return;
+			}
+			c.succeeded = file.open(c.path, native_file::open_read | native_file::open_sequential);
+			if(false == c.succeeded) return;
+			c.content.resize((size_t)file.size());
+			size_t done = 0;
+			while(done < c.content.size())
+			{
+				auto length = file.read(c.content.data() + done, c.content.size() - done);
+				if(0 >= length)
+				{
+					c.succeeded = 0 == length;
+					break;
+				}
+				done += (size_t)length;
+			}
+			c.content.resize(done);
+		}
+		void work()
+		{
+			std::vector<std::unique_ptr<request>> batch;
+			vector<file_completion> done;
+			while(take(batch, 16, true, true))
+			{
+				for(auto& r : batch)
+				{
+					execute(*r);
+					done.push_back(std::move(r->completion));
+				}
+				batch.clear();
+				complete(done);
+			}
+		}
+
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+		//A request goes through the ring as a chain of operations, one in flight at a time: open, stat (reads only), the transfers, then close.
+		enum stage_type {opening, stating, transferring, closing};
+		io_uring_sqe* queue_entry(request& r, int stage)
+		{
+			//Each request has one entry at most in the queue and there are no more requests in flight than its depth, thus the queue never runs out.
+			auto sqe = io_uring_get_sqe(&ring);
+			io_uring_sqe_set_data(sqe, &r);
+			r.stage = stage;
+			unsubmitted.push_back(&r);
+			return sqe;
+		}
+		void queue_open(request& r)
+		{
+			auto& c = r.completion;
+			r.done = 0;
+			r.handle = -1;
+			if(c.write)
+			{
+				//The parent directories are created once, the further files in them skip the blocking call.
+				auto parent = c.path.parent_path();
+				if(false == parent.empty() && directories.insert(parent.string()).second)
+				{
+					std::error_code ec;
+					std::experimental::filesystem::create_directories(parent, ec);
+				}
+				//The same mode as native_file, less the umask.
+				io_uring_prep_openat(queue_entry(r, opening), AT_FDCWD, c.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+			}
+			else
+				io_uring_prep_openat(queue_entry(r, opening), AT_FDCWD, c.path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+		}
+		void queue_transfer(request& r)
+		{
+			auto& c = r.completion;
+			auto length = (unsigned)(std::min)(c.content.size() - r.done, (size_t)1 << 30);
+			if(c.write)
+				io_uring_prep_write(queue_entry(r, transferring), r.handle, c.content.data() + r.done, length, r.done);
+			else
+				io_uring_prep_read(queue_entry(r, transferring), r.handle, c.content.data() + r.done, length, r.done);
+		}
+		void queue_close(request& r, bool succeeded)
+		{
+			r.completion.succeeded = succeeded;
+			io_uring_prep_close(queue_entry(r, closing), r.handle);
+		}
+		static void finish(request& r, vector<file_completion>& done)
+		{
+			if(0 <= r.handle)
+				::close(r.handle);
+			if(false == r.completion.write)
+				r.completion.content.resize(r.done);
+			done.push_back(std::move(r.completion));
+			delete &r;
+		}
+		//Moves the request on once its operation completes with result, returns true if the request has finished.
+		bool advance(request& r, int result, vector<file_completion>& done)
+		{
+			auto& c = r.completion;
+			switch(r.stage)
+			{
+			case opening:
+				if(0 > result)
+				{
+					c.succeeded = false;
+					finish(r, done);
+					return true;
+				}
+				r.handle = result;
+				if(false == c.write)
+					io_uring_prep_statx(queue_entry(r, stating), r.handle, "", AT_EMPTY_PATH, STATX_SIZE, &r.status);
+				else if(c.content.empty())
+					queue_close(r, true);
+				else
+					queue_transfer(r);
+				return false;
+			case stating:
+				if(0 > result)
+				{
+					queue_close(r, false);
+					return false;
+				}
+				c.content.resize((size_t)r.status.stx_size);
+				if(c.content.empty())
+					queue_close(r, true);
+				else
+					queue_transfer(r);
+				return false;
+			case transferring:
+				//A short transfer is continued from where it stopped, a read returning nothing means the file has shrunk.
+				if(0 < result)
+					r.done += (size_t)result;
+				if(0 < result && r.done < c.content.size())
+					queue_transfer(r);
+				else
+					queue_close(r, 0 <= result && (false == c.write || r.done == c.content.size()));
+				return false;
+			default:
+				//The descriptor is gone whatever the result, a failed close of a written file may mean the data never reached the disk.
+				r.handle = -1;
+				if(0 > result && c.write)
+					c.succeeded = false;
+				finish(r, done);
+				return true;
+			}
+		}
+		//Hands the queued entries to the kernel. Returns false if the ring can't take them any more.
+		bool submit_queued()
+		{
+			for(int retries = 0; false == unsubmitted.empty(); )
+			{
+				auto result = io_uring_submit(&ring);
+				if(0 < result)
+				{
+					in_kernel += (size_t)result;
+					unsubmitted.erase(unsubmitted.begin(), unsubmitted.begin() + (std::min)((size_t)result, unsubmitted.size()));
+					retries = 0;
+					continue;
+				}
+				//The kernel is short of memory or of room for the completions, the completions in flight make room once reaped.
+				if(0 == result || -EAGAIN == result || -EBUSY == result || -EINTR == result)
+				{
+					if(0 < in_kernel) return true;
+					if(++retries > 1000) return false;
+					boost::this_thread::yield();
+					continue;
+				}
+				return false;
+			}
+			return true;
+		}
+		//The ring failed, the requests in it are finished through the blocking path, and so are all the further ones.
+		void abandon_ring(vector<file_completion>& done)
+		{
+			auto restart = [&done](request& r)
+			{
+				if(0 <= r.handle)
+					::close(r.handle);
+				execute(r);
+				done.push_back(std::move(r.completion));
+				delete &r;
+			};
+			while(0 < in_kernel)
+			{
+				io_uring_cqe* cqe = nullptr;
+				auto result = io_uring_wait_cqe(&ring, &cqe);
+				if(-EINTR == result) continue;
+				if(0 != result) break;
+				auto& r = *reinterpret_cast<request*>(io_uring_cqe_get_data(cqe));
+				//A completed open or close leaves the descriptor as the result says.
+				if(opening == r.stage)
+					r.handle = cqe->res;
+				else if(closing == r.stage)
+					r.handle = -1;
+				io_uring_cq_advance(&ring, 1);
+				--in_kernel;
+				restart(r);
+			}
+			for(auto r : unsubmitted)
+				restart(*r);
+			unsubmitted.clear();
+			complete(done);
+			work();
+		}
+		//The single thread feeding the ring, it submits all the requests available with one system call and reaps all the completions available.
+		void drive()
+		{
+			std::vector<std::unique_ptr<request>> batch;
+			vector<file_completion> done;
+			size_t inflight = 0;
+			in_kernel = 0;
+			for(;;)
+			{
+				if(false == take(batch, depth - inflight, 0 == inflight) && 0 == inflight)
+					break;
+				for(auto& r : batch)
+				{
+					queue_open(*r.release());
+					++inflight;
+				}
+				batch.clear();
+				if(false == submit_queued())
+				{
+					abandon_ring(done);
+					return;
+				}
+				io_uring_cqe* cqe;
+				if(0 < in_kernel && 0 == io_uring_wait_cqe(&ring, &cqe))
+				{
+					unsigned head, count = 0;
+					io_uring_for_each_cqe(&ring, head, cqe)
+					{
+						++count;
+						if(advance(*reinterpret_cast<request*>(io_uring_cqe_get_data(cqe)), cqe->res, done))
+							--inflight;
+					}
+					io_uring_cq_advance(&ring, count);
+					in_kernel -= count;
+				}
+				complete(done);
+			}
+		}
+#endif
+	public:
+		//The threads are only used by the fallback path, depth bounds the requests in flight in io_uring.
+		explicit async_file_engine(size_t threads = boost::thread::hardware_concurrency(), size_t queue_depth = 256) : submitted(0), finished(0), stopping(false)
+		{
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+			depth = (std::max)(queue_depth, (size_t)1);
+			ring_ready = 0 == io_uring_queue_init((unsigned)depth, &ring, 0);
+			if(ring_ready)
+			{
+				//The open, stat and close operations came with Linux 5.6, the older kernels go through the threads.
+				auto probe = io_uring_get_probe_ring(&ring);
+				ring_ready = nullptr != probe && io_uring_opcode_supported(probe, IORING_OP_OPENAT) && io_uring_opcode_supported(probe, IORING_OP_STATX)
+					&& io_uring_opcode_supported(probe, IORING_OP_CLOSE) && io_uring_opcode_supported(probe, IORING_OP_READ) && io_uring_opcode_supported(probe, IORING_OP_WRITE);
+				if(nullptr != probe)
+					io_uring_free_probe(probe);
+				if(false == ring_ready)
+					io_uring_queue_exit(&ring);
+			}
+			if(ring_ready)
+			{
+				workers.emplace_back([this]() {drive();});
+				return;
+			}
+#endif
+			(void)queue_depth;
+			for(size_t k = 0; k < (std::max)(threads, (size_t)1); ++k)
+				workers.emplace_back([this]() {work();});
+		}
+		//Finishes all the submitted requests before returning, the completions not collected are dropped.
+		~async_file_engine()
+		{
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				stopping = true;
+				requests_ready.notify_all();
+			}
+			for(auto& worker : workers)
+				worker.join();
+#if defined(__linux__) && defined(FILEUTILITY_USE_IO_URING)
+			if(ring_ready)
+				io_uring_queue_exit(&ring);
+#endif
+		}
+		uint64_t submit_read(const std::experimental::filesystem::path& p)
+		{
+			std::unique_ptr<request> r(new request);
+			r->completion.path = p;
+			r->completion.write = false;
+			return submit(std::move(r));
+		}
+		uint64_t submit_write(const std::experimental::filesystem::path& p, vector<char> content)
+		{
+			std::unique_ptr<request> r(new request);
+			r->completion.path = p;
+			r->completion.content = std::move(content);
+			r->completion.write = true;
+			return submit(std::move(r));
+		}
+		//The number of the requests submitted but not collected yet.
+		uint64_t outstanding()
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			return submitted - finished + completions.size();
+		}
+		//Appends the finished requests to out, blocks until at least min_count have finished or nothing is outstanding.
+		//Returns the number appended, thus 0 means there is nothing left to wait for.
+		size_t wait(vector<file_completion>& out, size_t min_count = 1)
+		{
+			boost::unique_lock<boost::mutex> lock(m);
+			while(completions.size() < min_count && finished < submitted)
+				completions_ready.wait(lock);
+			auto count = completions.size();
+			for(auto& c : completions)
+				out.push_back(std::move(c));
+			completions.clear();
+			return count;
+		}
+		size_t poll(vector<file_completion>& out) {return wait(out, 0);}
+	};
+}
\ No newline at end of file
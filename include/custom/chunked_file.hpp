@@ -0,0 +1,299 @@
+/*
+	This library streams a file of any size through a few fixed-size buffers, in place of read_file and write_file which hold the whole content in memory.
+	The reader fills the next chunks on a background thread while the current one is processed, and the writer drains the full chunks on a background thread while the next one is filled,
+	so the processing overlaps the disk I/O. The buffers are recycled through a buffer_pool, thus nothing is allocated once the pipeline is running.
+
+	Here goes an example, which copies a file while counting its lines:
+
+	auto pool = fileutility::buffer_pool::create(4 << 20);
+	fileutility::chunked_reader reader(L"huge.log", pool);
+	fileutility::chunked_writer writer(L"copy.log", pool);
+	fileutility::file_chunk chunk;
+	size_t lines = 0;
+	while(reader.next(chunk))
+	{
+		lines += std::count(chunk.begin(), chunk.end(), '\n');
+		writer.write(chunk);	//The buffer is handed over instead of copied.
+	}
+	bool succeeded = false == reader.failed() && writer.close();
+
+	A UTF-8 file is decoded the same way with for_each_wide_chunk, which carries the sequences cut by the chunk boundaries over to the next chunk.
+*/
+
+#pragma once
+#include <custom/fileutility.hpp>
+#include <custom/transcode.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+
+namespace fileutility
+{
+	//The pool of the equally sized aligned buffers. A buffer goes back to the pool when its last shared_ptr is released.
+	class buffer_pool : public std::enable_shared_from_this<buffer_pool>, boost::noncopyable
+	{
+	private:
+		size_t										m_buffer_size;
+		boost::mutex								m;
+		std::vector<std::unique_ptr<aligned_buffer>>	m_free;
+		explicit buffer_pool(size_t buffer_size) : m_buffer_size(buffer_size) {}
+	public:
+		static std::shared_ptr<buffer_pool> create(size_t buffer_size = 4 << 20)
+		{
+			return std::shared_ptr<buffer_pool>(new buffer_pool(buffer_size));
+		}
+		size_t buffer_size()const {return m_buffer_size;}
+		std::shared_ptr<aligned_buffer> acquire()
+		{
+			std::unique_ptr<aligned_buffer> buffer;
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				if(false == m_free.empty())
+				{
+					buffer = std::move(m_free.back());
+					m_free.pop_back();
+				}
+			}
+			if(nullptr == buffer)
+				buffer.reset(new aligned_buffer(m_buffer_size));
+			auto self = shared_from_this();
+			return std::shared_ptr<aligned_buffer>(buffer.release(), [self](aligned_buffer* released)
+			{
+				boost::lock_guard<boost::mutex> lock(self->m);
+				self->m_free.emplace_back(released);
+			});
+		}
+	};
+
+	struct file_chunk
+	{
+		std::shared_ptr<aligned_buffer>	buffer;
+		size_t							size;
+		uint64_t						offset;		//The position of the chunk in the file.
+		const char* data()const {return buffer->data();}
+		const char* begin()const {return buffer->data();}
+		const char* end()const {return buffer->data() + size;}
+	};
+
+	class chunked_reader : boost::noncopyable
+	{
+	private:
+		native_file						file;
+		std::shared_ptr<buffer_pool>	pool;
+		size_t							depth;
+		boost::mutex					m;
+		boost::condition_variable		cv;
+		std::deque<file_chunk>			ready;
+		bool							finished;
+		bool							m_failed;
+		bool							stopping;
+		boost::thread					reader;
+
+		void read_loop()
+		{
+			uint64_t offset = 0;
+			for(;;)
+			{
+				{
+					boost::unique_lock<boost::mutex> lock(m);
+					while(ready.size() >= depth && false == stopping)
+						cv.wait(lock);
+					if(stopping) return;
+				}
+				file_chunk chunk = {pool->acquire(), 0, offset};
+				int64_t length = 0;
+				while(chunk.size < chunk.buffer->size() && 0 < (length = file.read(chunk.buffer->data() + chunk.size, chunk.buffer->size() - chunk.size)))
+					chunk.size += (size_t)length;
+				offset += chunk.size;
+				boost::lock_guard<boost::mutex> lock(m);
+				if(0 < chunk.size)
+					ready.push_back(std::move(chunk));
+				finished = 0 >= length;
+				m_failed = 0 > length;
+				cv.notify_all();
+				if(finished) return;
+			}
+		}
+	public:
+		//Up to read_ahead chunks are read before they are asked for, 2 is enough to keep the disk busy while a chunk is processed.
+		chunked_reader(const std::experimental::filesystem::path& p, std::shared_ptr<buffer_pool> buffers = buffer_pool::create(), size_t read_ahead = 2)
+			: file(p, native_file::open_read | native_file::open_sequential), pool(buffers), depth((std::max)(read_ahead, (size_t)1)), finished(false), m_failed(false), stopping(false)
+		{
+			if(file.is_open())
+				reader = boost::thread([this]() {read_loop();});
+			else
+				finished = m_failed = true;
+		}
+		~chunked_reader()
+		{
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				stopping = true;
+				cv.notify_all();
+			}
+			if(reader.joinable())
+				reader.join();
+		}
+		//Takes the next chunk, returns false at the end of the file or on failure. The chunk keeps its buffer out of the pool until it is released or overwritten.
+		bool next(file_chunk& chunk)
+		{
+			chunk.buffer.reset();
+			boost::unique_lock<boost::mutex> lock(m);
+			while(ready.empty() && false == finished)
+				cv.wait(lock);
+			if(ready.empty()) return false;
+			chunk = std::move(ready.front());
+			ready.pop_front();
+			cv.notify_all();
+			return true;
+		}
+		//Whether the file failed to open or to read, which is only meaningful after next returned false.
+		bool failed()
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			return m_failed;
+		}
+	};
+
+	class chunked_writer : boost::noncopyable
+	{
+	private:
+		native_file						file;
+		std::shared_ptr<buffer_pool>	pool;
+		size_t							depth;
+		file_chunk						current;
+		boost::mutex					m;
+		boost::condition_variable		cv;
+		std::deque<file_chunk>			full;
+		bool							m_failed;
+		bool							closing;
+		boost::thread					writer;
+
+		void write_loop()
+		{
+			for(;;)
+			{
+				file_chunk chunk;
+				{
+					boost::unique_lock<boost::mutex> lock(m);
+					while(full.empty() && false == closing)
+						cv.wait(lock);
+					if(full.empty()) return;
+					chunk = std::move(full.front());
+				}
+				bool succeeded = file.write(chunk.data(), chunk.size);
+				boost::lock_guard<boost::mutex> lock(m);
+				full.pop_front();
+				m_failed = m_failed || false == succeeded;
+				cv.notify_all();
+			}
+		}
+		bool enqueue(file_chunk chunk)
+		{
+			boost::unique_lock<boost::mutex> lock(m);
+			while(full.size() >= depth && false == m_failed)
+				cv.wait(lock);
+			if(m_failed) return false;
+			full.push_back(std::move(chunk));
+			cv.notify_all();
+			return true;
+		}
+		bool flush_current()
+		{
+			if(nullptr == current.buffer || 0 == current.size) return true;
+			file_chunk chunk = std::move(current);
+			current = file_chunk();
+			return enqueue(std::move(chunk));
+		}
+	public:
+		//Up to write_behind full chunks may wait for the disk before write blocks.
+		chunked_writer(const std::experimental::filesystem::path& p, std::shared_ptr<buffer_pool> buffers = buffer_pool::create(), size_t write_behind = 2)
+			: pool(buffers), depth((std::max)(write_behind, (size_t)1)), m_failed(false), closing(false)
+		{
+			std::error_code ec;
+			std::experimental::filesystem::create_directories(std::experimental::filesystem::path(p).parent_path(), ec);
+			current.size = 0;
+			if(file.open(p, native_file::open_write | native_file::open_sequential))
+				writer = boost::thread([this]() {write_loop();});
+			else
+				m_failed = true;
+		}
+		~chunked_writer() {close();}
+		//Copies the data into the pooled buffers, returns false once any write has failed.
+		bool write(const void* data, size_t size)
+		{
+			auto p = reinterpret_cast<const char*>(data);
+			while(0 < size)
+			{
+				if(nullptr == current.buffer)
+				{
+					current.buffer = pool->acquire();
+					current.size = 0;
+				}
+				size_t length = (std::min)(size, current.buffer->size() - current.size);
+				memcpy(current.buffer->data() + current.size, p, length);
+				current.size += length;
+				p += length;
+				size -= length;
+				if(current.size == current.buffer->size() && false == flush_current())
+					return false;
+			}
+			return false == failed();
+		}
+		//Queues the chunk itself without copying, after whatever has been written before it.
+		bool write(const file_chunk& chunk)
+		{
+			if(0 == chunk.size) return false == failed();
+			return flush_current() && enqueue(chunk);
+		}
+		//Writes out the rest and closes the file, returns whether everything has been written.
+		bool close()
+		{
+			if(writer.joinable())
+			{
+				flush_current();
+				{
+					boost::lock_guard<boost::mutex> lock(m);
+					closing = true;
+					cv.notify_all();
+				}
+				writer.join();
+				file.close();
+			}
+			return false == failed();
+		}
+		bool failed()
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			return m_failed;
+		}
+	};
+
+	//Calls f(const char* data, size_t size) with the consecutive chunks of the file, returns false if the file can't be read completely.
+	template<typename Function>
+	inline bool for_each_chunk(const std::experimental::filesystem::path& p, Function f, std::shared_ptr<buffer_pool> buffers = buffer_pool::create())
+	{
+		chunked_reader reader(p, buffers);
+		file_chunk chunk;
+		while(reader.next(chunk))
+			f(chunk.data(), chunk.size);
+		return false == reader.failed();
+	}
+	//Calls f(const wchar_t* text, size_t size) with the consecutive pieces of the UTF-8 file decoded, in constant memory however large the file is.
+	//The sequences cut by the chunk boundaries are carried over, thus the pieces are the same as decoding the whole file at once.
+	template<typename Function>
+	inline bool for_each_wide_chunk(const std::experimental::filesystem::path& p, Function f, std::shared_ptr<buffer_pool> buffers = buffer_pool::create())
+	{
+		transcode::utf8_to_wide_stream decoder;
+		vector<wchar_t> wide(transcode::utf8_to_wide_stream::max_length(buffers->buffer_size()));
+		auto succeeded = for_each_chunk(p, [&](const char* data, size_t size)
+		{
+			auto length = decoder.convert(data, size, wide.data());
+			if(0 < length)
+				f(static_cast<const wchar_t*>(wide.data()), length);
+		}, buffers);
+		auto length = decoder.finish(wide.data());
+		if(0 < length)
+			f(static_cast<const wchar_t*>(wide.data()), length);
+		return succeeded;
+	}
+}
\ No newline at end of file
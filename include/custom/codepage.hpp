@@ -3,42 +3,290 @@
 	Date:	2013-02-27
 
 	This library encapsulates MultiByteToWideChar and WideCharToMultiByte into more convenient function, offering transformation between arbitrary encoding and unicode.
+	UTF-8 is transcoded by the library itself on all the platforms, the other code pages go through the OS on Windows.
+	Elsewhere the common single-byte code pages (Windows-125x, ISO-8859-x) are converted by the built-in tables, and the ANSI code page is taken as UTF-8, as the locales of Linux are.
 */
 #pragma once
-#include <Windows.h>
+#include <custom/transcode.hpp>
+#include <custom/codepage_tables.hpp>
+#include <custom/usefulfunctions.hpp>
 #include <string>
+#include <type_traits>
+#include <numeric>
+#include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_view.hpp>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#define CP_ACP	0
+#define CP_UTF8	65001
+#endif
 class codepage
 {
+private:
+	//How a code page is converted, UTF-8 is converted by the library, the rest by the OS on Windows and by the built-in tables elsewhere.
+	//The tables aren't used on Windows, the OS decodes the undefined bytes of some code pages to the private use area and encodes with the best fit mapping.
+	enum {utf8_conversion, table_conversion, os_conversion};
+	template<unsigned long CodePage>
+	struct conversion_of : std::integral_constant<int, CP_UTF8 == CodePage ? utf8_conversion :
+#ifdef _WIN32
+		os_conversion> {};
+#else
+		CP_ACP == CodePage ? utf8_conversion : transcode::single_byte_table<CodePage>::value ? table_conversion : os_conversion> {};
+#endif
+	typedef std::integral_constant<int, utf8_conversion>	utf8_tag;
+	typedef std::integral_constant<int, table_conversion>	table_tag;
+	typedef std::integral_constant<int, os_conversion>		os_tag;
+
+	//The raw conversion group, writing into a buffer of the worst case length.
+	static size_t _max_unicode_length_imply(size_t size, utf8_tag) {return transcode::max_wide_length_from_utf8(size);}
+	static size_t _max_unicode_length_imply(size_t size, table_tag) {return size;}
+	static size_t _max_unicode_length_imply(size_t size, os_tag) {return size;}
+	template<unsigned long CodePage>
+	static size_t _max_text_length_imply(size_t size, utf8_tag) {return transcode::max_utf8_length_from_wide(size);}
+	template<unsigned long CodePage>
+	static size_t _max_text_length_imply(size_t size, table_tag) {return size;}
+	//A character of GB18030 takes up to 4 bytes, which is the most of the code pages without the shift states.
+	//The stateful ones, ISO-2022 (50220-50229), HZ (52936) and UTF-7 (65000), wrap the characters in escape sequences, a lone kanji of ISO-2022-JP takes 8 bytes.
+	template<unsigned long CodePage>
+	static size_t _max_text_length_imply(size_t size, os_tag) {return size * ((50220 <= CodePage && CodePage <= 50229) || 52936 == CodePage || 65000 == CodePage ? 8 : 4);}
+	template<unsigned long CodePage>
+	static size_t _to_unicode_imply(const char* text, size_t size, wchar_t* out, utf8_tag) {return transcode::utf8_to_wide(text, size, out);}
+	template<unsigned long CodePage>
+	static size_t _unicode_to_imply(const wchar_t* unicode, size_t size, char* out, utf8_tag) {return transcode::wide_to_utf8(unicode, size, out);}
+	template<unsigned long CodePage>
+	static size_t _to_unicode_imply(const char* text, size_t size, wchar_t* out, table_tag)
+	{
+		return transcode::single_byte_to_wide(text, size, transcode::single_byte_table<CodePage>::high(), out);
+	}
+	template<unsigned long CodePage>
+	static size_t _unicode_to_imply(const wchar_t* unicode, size_t size, char* out, table_tag)
+	{
+		return transcode::single_byte_encoder::instance<CodePage>().encode(unicode, size, out);
+	}
+#ifdef _WIN32
+	template<unsigned long CodePage>
+	static size_t _to_unicode_imply(const char* text, size_t size, wchar_t* out, os_tag)
+	{
+		if(0 == size) return 0;
+		return MultiByteToWideChar(CodePage, 0, text, (int)size, out, (int)_max_unicode_length_imply(size, os_tag()));
+	}
+	template<unsigned long CodePage>
+	static size_t _unicode_to_imply(const wchar_t* unicode, size_t size, char* out, os_tag)
+	{
+		if(0 == size) return 0;
+		return WideCharToMultiByte(CodePage, 0, unicode, (int)size, out, (int)_max_text_length_imply<CodePage>(size, os_tag()), nullptr, nullptr);
+	}
+	//The length measured by the OS when a conversion through the OS failed for the lack of room, 0 otherwise.
+	//It lets the callers owning the output fall back to converting into a buffer of the exact length, should an escape sequence ever exceed the worst case length.
+	template<unsigned long CodePage>
+	static size_t _measured_text_length_imply(const wchar_t* unicode, size_t size, size_t written)
+	{
+		if(0 != written || 0 == size || os_conversion != conversion_of<CodePage>::value || ERROR_INSUFFICIENT_BUFFER != GetLastError()) return 0;
+		return (size_t)(std::max)(0, WideCharToMultiByte(CodePage, 0, unicode, (int)size, nullptr, 0, nullptr, nullptr));
+	}
+#endif
+	//The results returned by value are sized exactly instead of keeping the capacity of the worst case length, UTF-8 is measured first since that is cheaper than converting.
+	template<unsigned long CodePage>
+	static std::wstring _to_unicode_imply(const std::string& text, utf8_tag)
+	{
+		std::wstring unicode(transcode::wide_length_from_utf8(text.data(), text.size()), L'\0');
+		if(false == unicode.empty())
+			transcode::utf8_to_wide(text.data(), text.size(), &unicode[0]);
+		return unicode;
+	}
+	template<unsigned long CodePage>
+	static std::string _unicode_to_imply(const std::wstring& unicode, utf8_tag)
+	{
+		std::string text(transcode::utf8_length_from_wide(unicode.data(), unicode.size()), '\0');
+		if(false == text.empty())
+			transcode::wide_to_utf8(unicode.data(), unicode.size(), &text[0]);
+		return text;
+	}
+	template<unsigned long CodePage, typename Tag>
+	static std::wstring _to_unicode_imply(const std::string& text, Tag)
+	{
+		std::wstring unicode;
+		_to_unicode<CodePage>(text, unicode);
+		unicode.shrink_to_fit();
+		return unicode;
+	}
+	template<unsigned long CodePage, typename Tag>
+	static std::string _unicode_to_imply(const std::wstring& unicode, Tag)
+	{
+		std::string text;
+		_unicode_to<CodePage>(unicode, text);
+		text.shrink_to_fit();
+		return text;
+	}
+	//Cuts the text at the boundaries into a segment per thread, measures the output of the segments in parallel, and converts them in parallel straight into their places,
+	//which are given by the prefix sum of the measured lengths.
+	template<typename Output, typename Input, typename Boundary, typename Measure, typename Convert>
+	static Output _parallel_imply(const Input& text, size_t threads, Boundary boundary, Measure measure, Convert convert)
+	{
+		//Each thread takes at least 256K units, the smaller segments cost more to schedule than to convert.
+		threads = (std::max)((size_t)1, (std::min)(threads, text.size() >> 18));
+		std::vector<size_t> bounds(threads + 1, text.size()), offsets(threads + 1, 0);
+		bounds[0] = 0;
+		for(size_t k = 1; k < threads; ++k)
+			bounds[k] = boundary(text.data(), text.size(), (std::max)(bounds[k - 1], text.size() / threads * k));
+		custom::parallel_for(threads, [&](size_t k) {offsets[k + 1] = measure(text.data() + bounds[k], bounds[k + 1] - bounds[k]);}, threads, 1);
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+		Output output(offsets[threads], typename Output::value_type());
+		custom::parallel_for(threads, [&](size_t k) {convert(text.data() + bounds[k], bounds[k + 1] - bounds[k], &output[0] + offsets[k]);}, threads, 1);
+		return output;
+	}
 public:
+	//The memory of the texts converted for a batch of work, such as a request, which is released all at once by reset.
+	//The texts are handed out as views into the arena, which stay valid until reset. Once the arena has grown to fit a batch, nothing is allocated any more.
+	class arena : boost::noncopyable
+	{
+	private:
+		std::vector<std::unique_ptr<char[]>>	blocks;
+		size_t									block_size;
+		size_t									used;		//The bytes used of the last block.
+		size_t									capacity;	//The bytes of the last block.
+		size_t									total;		//The bytes of all the blocks.
+	public:
+		explicit arena(size_t initial_size = 64 << 10) : block_size(initial_size), used(0), capacity(0), total(0) {}
+		template<typename Unit>
+		Unit* allocate(size_t count)
+		{
+			used = (used + alignof(Unit) - 1) & ~(alignof(Unit) - 1);
+			if(blocks.empty() || used + count * sizeof(Unit) > capacity)
+			{
+				capacity = (std::max)(block_size, count * sizeof(Unit));
+				blocks.emplace_back(new char[capacity]);
+				total += capacity;
+				used = 0;
+			}
+			auto p = reinterpret_cast<Unit*>(blocks.back().get() + used);
+			used += count * sizeof(Unit);
+			return p;
+		}
+		//Gives back the unused end of the latest allocation, since a conversion allocates for the worst case.
+		template<typename Unit>
+		void shrink(Unit* p, size_t count)
+		{
+			used = reinterpret_cast<char*>(p + count) - blocks.back().get();
+		}
+		//Releases all the texts. The blocks are merged into one as large as all of them, so the next batch of the same size fits in it.
+		void reset()
+		{
+			if(1 < blocks.size())
+			{
+				blocks.clear();
+				block_size = total;
+				blocks.emplace_back(new char[total]);
+			}
+			capacity = total;
+			used = 0;
+		}
+	};
+
 	//The utf8 and unicode transforming group.
 	static std::wstring utf8_to_unicode(const std::string& utf8) {return _to_unicode<CP_UTF8>(utf8);}
 	static std::string unicode_to_utf8(const std::wstring& unicode) {return _unicode_to<CP_UTF8>(unicode);}
+	static void utf8_to_unicode(const std::string& utf8, std::wstring& unicode, bool append = false) {_to_unicode<CP_UTF8>(utf8, unicode, append);}
+	static void unicode_to_utf8(const std::wstring& unicode, std::string& utf8, bool append = false) {_unicode_to<CP_UTF8>(unicode, utf8, append);}
+	static boost::wstring_view utf8_to_unicode(boost::string_view utf8, arena& memory) {return _to_unicode<CP_UTF8>(utf8, memory);}
+	static boost::string_view unicode_to_utf8(boost::wstring_view unicode, arena& memory) {return _unicode_to<CP_UTF8>(unicode, memory);}
+
+	//The parallel utf8 and unicode transforming group, for the texts of many megabytes. The result is the same as the single threaded one.
+	static std::wstring utf8_to_unicode(const std::string& utf8, size_t threads)
+	{
+		return _parallel_imply<std::wstring>(utf8, threads, transcode::utf8_boundary, transcode::wide_length_from_utf8, transcode::utf8_to_wide);
+	}
+	static std::string unicode_to_utf8(const std::wstring& unicode, size_t threads)
+	{
+		return _parallel_imply<std::string>(unicode, threads, transcode::wide_boundary, transcode::utf8_length_from_wide, transcode::wide_to_utf8);
+	}
+
+	//The checking group, none of which converts or allocates.
+	static bool is_valid_utf8(const std::string& utf8) {return transcode::validate_utf8(utf8.data(), utf8.size());}
+	//The length of utf8_to_unicode(utf8) for a valid utf8, without converting it.
+	static size_t unicode_length(const std::string& utf8)
+	{
+		return 2 == sizeof(wchar_t) ? transcode::utf16_length_from_utf8(utf8.data(), utf8.size()) : transcode::utf32_length_from_utf8(utf8.data(), utf8.size());
+	}
+	//The length of unicode_to_utf8(unicode) for a unicode without unpaired surrogates, without converting it.
+	static size_t utf8_length(const std::wstring& unicode)
+	{
+		return 2 == sizeof(wchar_t) ? transcode::utf8_length_from_utf16(reinterpret_cast<const char16_t*>(unicode.data()), unicode.size()) : transcode::utf8_length_from_utf32(reinterpret_cast<const char32_t*>(unicode.data()), unicode.size());
+	}
 
 	//The ASCII and unicode transforming group
 	static std::wstring acp_to_unicode(const std::string& text) {return _to_unicode<CP_ACP>(text);}
 	static std::string unicode_to_acp(const std::wstring& unicode) {return _unicode_to<CP_ACP>(unicode);}
+	static void acp_to_unicode(const std::string& text, std::wstring& unicode, bool append = false) {_to_unicode<CP_ACP>(text, unicode, append);}
+	static void unicode_to_acp(const std::wstring& unicode, std::string& text, bool append = false) {_unicode_to<CP_ACP>(unicode, text, append);}
 
 	//The generic transforming group.
 	template<unsigned long CodePage>
-	static std::wstring _to_unicode(const std::string& text)
+	static std::wstring _to_unicode(const std::string& text) {return _to_unicode_imply<CodePage>(text, typename conversion_of<CodePage>::type());}
+	template<unsigned long CodePage>
+	static std::wstring _to_unicode(const std::wstring& text) {return text;}
+	template<unsigned long CodePage>
+	static std::string _unicode_to(const std::wstring& unicode) {return _unicode_to_imply<CodePage>(unicode, typename conversion_of<CodePage>::type());}
+	template<unsigned long CodePage>
+	static std::string _unicode_to(const std::string& unicode) {return unicode;}
+
+	//The buffer group, which overwrites the output or appends to it, reusing its capacity. Only the part grown beyond the current size is filled before converting.
+	template<unsigned long CodePage>
+	static void _to_unicode(const std::string& text, std::wstring& unicode, bool append = false)
 	{
-		if(text.empty()) return L"";
-		size_t length = MultiByteToWideChar(CodePage, 0, text.c_str(), (int)text.size(), nullptr, 0);
-		std::wstring unicode(length, L'C');
-		MultiByteToWideChar(CodePage, 0, text.c_str(), (int)text.size(), &*unicode.begin(), (int)length);
-		return unicode;
+		size_t offset = append ? unicode.size() : 0;
+		unicode.resize(offset + max_unicode_length<CodePage>(text.size()));
+		unicode.resize(offset + _to_unicode<CodePage>(text.data(), text.size(), &unicode[0] + offset));
 	}
 	template<unsigned long CodePage>
-	static std::wstring _to_unicode(const std::wstring& text) {return text;}
+	static void _unicode_to(const std::wstring& unicode, std::string& text, bool append = false)
+	{
+		size_t offset = append ? text.size() : 0;
+		text.resize(offset + max_text_length<CodePage>(unicode.size()));
+		auto length = _unicode_to<CodePage>(unicode.data(), unicode.size(), &text[0] + offset);
+#ifdef _WIN32
+		if(auto needed = _measured_text_length_imply<CodePage>(unicode.data(), unicode.size(), length))
+		{
+			text.resize(offset + needed);
+			length = (size_t)(std::max)(0, WideCharToMultiByte(CodePage, 0, unicode.data(), (int)unicode.size(), &text[0] + offset, (int)needed, nullptr, nullptr));
+		}
+#endif
+		text.resize(offset + length);
+	}
 	template<unsigned long CodePage>
-	static std::string _unicode_to(const std::wstring& unicode)
+	static boost::wstring_view _to_unicode(boost::string_view text, arena& memory)
 	{
-		if(unicode.empty()) return "";
-		size_t length = WideCharToMultiByte(CodePage, 0, unicode.c_str(), (int)unicode.length(), nullptr, 0, nullptr, nullptr);
-		std::string text(length, 'C');
-		WideCharToMultiByte(CodePage, 0, unicode.c_str(), (int)unicode.length(), &*text.begin(), (int)length, nullptr, nullptr);
-		return text;
+		auto out = memory.allocate<wchar_t>(max_unicode_length<CodePage>(text.size()));
+		auto length = _to_unicode<CodePage>(text.data(), text.size(), out);
+		memory.shrink(out, length);
+		return boost::wstring_view(out, length);
 	}
 	template<unsigned long CodePage>
-	static std::string _unicode_to(const std::string& unicode) {return unicode;}
+	static boost::string_view _unicode_to(boost::wstring_view unicode, arena& memory)
+	{
+		auto out = memory.allocate<char>(max_text_length<CodePage>(unicode.size()));
+		auto length = _unicode_to<CodePage>(unicode.data(), unicode.size(), out);
+#ifdef _WIN32
+		if(auto needed = _measured_text_length_imply<CodePage>(unicode.data(), unicode.size(), length))
+		{
+			memory.shrink(out, 0);
+			out = memory.allocate<char>(needed);
+			length = (size_t)(std::max)(0, WideCharToMultiByte(CodePage, 0, unicode.data(), (int)unicode.size(), out, (int)needed, nullptr, nullptr));
+		}
+#endif
+		memory.shrink(out, length);
+		return boost::string_view(out, length);
+	}
+	//The raw buffer group, the output must hold the length given by max_unicode_length or max_text_length. Returns the number of the units written.
+	template<unsigned long CodePage>
+	static size_t max_unicode_length(size_t size) {return _max_unicode_length_imply(size, conversion_of<CodePage>());}
+	template<unsigned long CodePage>
+	static size_t max_text_length(size_t size) {return _max_text_length_imply<CodePage>(size, conversion_of<CodePage>());}
+	template<unsigned long CodePage>
+	static size_t _to_unicode(const char* text, size_t size, wchar_t* unicode) {return _to_unicode_imply<CodePage>(text, size, unicode, conversion_of<CodePage>());}
+	template<unsigned long CodePage>
+	static size_t _unicode_to(const wchar_t* unicode, size_t size, char* text) {return _unicode_to_imply<CodePage>(unicode, size, text, conversion_of<CodePage>());}
 };
\ No newline at end of file
@@ -0,0 +1,210 @@
+/*
+	This library walks a directory tree on several threads and yields the paths already normalized the way get_normalized_path does.
+	The normalized path of an entry is built by appending its name to the normalized path of its parent, so no path is normalized twice,
+	and the path relative to the root is just an offset into the full path, instead of comparing and cutting strings like relative_path does.
+
+	Each thread owns a queue of the directories to scan, it takes the latest one from its own queue and steals the oldest one from the others when running out,
+	thus a huge subdirectory is spread over all the threads. Symbolic links to directories are reported but not followed.
+
+	Here goes an example:
+
+	fileutility::walk_directory(L"D:/data", [](const fileutility::walk_entry& entry)
+	{
+		if(false == entry.directory)
+			index(entry.path, entry.relative());	//Called on the walking threads concurrently.
+	});
+*/
+
+#pragma once
+#include <custom/fileutility.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <exception>
+#include <iterator>
+
+namespace fileutility
+{
+	struct walk_entry
+	{
+		wstring	path;				//The normalized full path, separated by '/'.
+		size_t	relative_offset;	//Where the path relative to the root starts.
+		bool	directory;
+		const wchar_t* relative()const {return path.c_str() + relative_offset;}
+	};
+
+	class directory_walker : boost::noncopyable
+	{
+	private:
+		struct directory_queue
+		{
+			boost::mutex		m;
+			std::deque<wstring>	directories;
+		};
+		std::vector<std::unique_ptr<directory_queue>>	queues;
+		std::atomic<size_t>								pending;	//The directories pushed and not scanned yet.
+		std::atomic<size_t>								queued;		//The directories pushed and not popped yet.
+		std::atomic<size_t>								sleeping;
+		std::atomic<size_t>								unconvertible;
+		std::atomic<bool>								stopped;	//A worker failed, the others leave as soon as possible.
+		std::exception_ptr								failure;
+		boost::mutex									idle;
+		boost::condition_variable						wake;
+		wstring											root;
+		size_t											relative_offset;
+
+		void push(size_t self, wstring directory)
+		{
+			++pending;
+			{
+				boost::lock_guard<boost::mutex> lock(queues[self]->m);
+				queues[self]->directories.push_back(std::move(directory));
+			}
+			++queued;
+			//A worker going to sleep counts itself before checking queued, thus either it sees the directory or it is seen here.
+			if(0 < sleeping.load())
+			{
+				boost::lock_guard<boost::mutex> lock(idle);
+				wake.notify_one();
+			}
+		}
+		bool pop(size_t self, wstring& directory)
+		{
+			for(size_t k = 0; k < queues.size(); ++k)
+			{
+				auto& queue = *queues[(self + k) % queues.size()];
+				boost::lock_guard<boost::mutex> lock(queue.m);
+				if(queue.directories.empty()) continue;
+				if(0 == k)
+				{
+					directory = std::move(queue.directories.back());
+					queue.directories.pop_back();
+				}
+				else
+				{
+					directory = std::move(queue.directories.front());
+					queue.directories.pop_front();
+				}
+				--queued;
+				return true;
+			}
+			return false;
+		}
+		template<typename Visitor>
+		void scan(size_t self, const wstring& directory, Visitor& visitor)
+		{
+			std::error_code ec;
+			//The root is listed as given, its normalized form drops the trailing separator, which turns "/" into "" and "C:/" into the current directory of the drive.
+			auto& listed = directory.size() + 1 == relative_offset ? root : directory;
+			for(std::experimental::filesystem::directory_iterator it(listed, ec), end; end != it; it.increment(ec))
+			{
+				if(stopped.load()) return;
+				walk_entry entry;
+				entry.path.reserve(directory.size() + 64);
+				entry.path = directory;
+				entry.path += L'/';
+				//A name which isn't valid in the encoding of the file system, such as a name of invalid UTF-8 on Linux, has no wide form and is skipped.
+				try
+				{
+					entry.path += it->path().filename().wstring();
+				}
+				catch(const std::experimental::filesystem::filesystem_error&)
+				{
+					++unconvertible;
+					continue;
+				}
+				entry.relative_offset = relative_offset;
+				entry.directory = std::experimental::filesystem::is_directory(it->symlink_status(ec));
+				if(entry.directory)
+					push(self, entry.path);
+				const walk_entry& visited = entry;
+				visitor(self, visited);
+			}
+		}
+		template<typename Visitor>
+		void work(size_t self, Visitor& visitor)
+		{
+			wstring directory;
+			try
+			{
+				while(false == stopped.load())
+				{
+					if(pop(self, directory))
+					{
+						scan(self, directory, visitor);
+						if(0 == --pending)
+						{
+							boost::lock_guard<boost::mutex> lock(idle);
+							wake.notify_all();
+						}
+						continue;
+					}
+					//Sleeps until a directory is pushed or the walk is over, instead of spinning through the whole walk.
+					boost::unique_lock<boost::mutex> lock(idle);
+					++sleeping;
+					wake.wait(lock, [this]() {return 0 != queued.load() || 0 == pending.load() || stopped.load();});
+					--sleeping;
+					if(0 == pending.load()) return;
+				}
+			}
+			catch(...)
+			{
+				//An exception must not leave a worker thread, the first one is kept for walk to rethrow on the calling thread.
+				boost::lock_guard<boost::mutex> lock(idle);
+				if(nullptr == failure)
+					failure = std::current_exception();
+				stopped = true;
+				wake.notify_all();
+			}
+		}
+	public:
+		directory_walker() : pending(0), queued(0), sleeping(0), unconvertible(0), stopped(false), relative_offset(0) {}
+		//Calls visitor(size_t worker, const walk_entry&) for each entry under root, where worker is the index of the calling thread in [0, threads).
+		//The visitor is called concurrently, but never concurrently with the same worker index, thus it may keep the per-worker state without locking. The root itself is not visited.
+		//An exception thrown by the visitor or the walk stops all the workers, and the first one is rethrown here once they have all finished.
+		template<typename Visitor>
+		void walk(const std::experimental::filesystem::path& root, Visitor visitor, size_t threads = boost::thread::hardware_concurrency())
+		{
+			threads = (std::max)(threads, (size_t)1);
+			pending = 0;
+			queued = 0;
+			unconvertible = 0;
+			stopped = false;
+			failure = nullptr;
+			queues.clear();
+			for(size_t k = 0; k < threads; ++k)
+				queues.emplace_back(new directory_queue);
+			this->root = root.wstring();
+			auto base = get_normalized_path(root);
+			relative_offset = base.size() + 1;
+			push(0, base);
+			std::vector<boost::thread> workers;
+			for(size_t k = 1; k < threads; ++k)
+				workers.emplace_back([this, k, &visitor]() {work(k, visitor);});
+			work(0, visitor);
+			for(auto& worker : workers)
+				worker.join();
+			if(nullptr != failure)
+				std::rethrow_exception(failure);
+		}
+		//The entries skipped by the last walk, since their names have no wide form.
+		size_t skipped()const {return unconvertible.load();}
+	};
+
+	//Calls visitor(const walk_entry&) for each entry under root, concurrently from the walking threads.
+	template<typename Visitor>
+	inline void walk_directory(const std::experimental::filesystem::path& root, Visitor visitor, size_t threads = boost::thread::hardware_concurrency())
+	{
+		directory_walker().walk(root, [&visitor](size_t, const walk_entry& entry) {visitor(entry);}, threads);
+	}
+	//Collects all the entries under root, in no particular order.
+	inline vector<walk_entry> collect_directory(const std::experimental::filesystem::path& root, size_t threads = boost::thread::hardware_concurrency())
+	{
+		threads = (std::max)(threads, (size_t)1);
+		std::vector<vector<walk_entry>> collected(threads);
+		directory_walker().walk(root, [&collected](size_t worker, const walk_entry& entry) {collected[worker].push_back(entry);}, threads);
+		vector<walk_entry> entries = std::move(collected[0]);
+		for(size_t k = 1; k < threads; ++k)
+			std::move(collected[k].begin(), collected[k].end(), std::back_inserter(entries));
+		return entries;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*
+	This library remembers the md5 of the files by their (path, size, last write time), so a file which hasn't changed since it was hashed is neither read nor hashed again.
+	Optionally the contents of the files recently read are kept in memory too, bounded by the total bytes and evicted by least recent use.
+	The md5 records can be saved to and loaded from a file through compact_archive, so that incremental runs skip the unchanged files entirely.
+
+	Like any cache keyed by the modification time, a file rewritten with the same size within the timestamp resolution is taken as unchanged.
+
+	Here goes an example:
+
+	custom::file_cache cache(256 << 20);	//Keeps up to 256MB of contents.
+	cache.load(L"index.cache");
+	for(auto& p : paths)
+	{
+		if(cache.unchanged(p)) continue;
+		auto content = cache.read(p);
+		auto digest = cache.md5(p);			//Hashes the content read above, no I/O involved.
+		...
+	}
+	cache.save(L"index.cache");
+*/
+
+#pragma once
+#include <custom/usefultypes.hpp>
+#include <custom/fileutility.hpp>
+#include <custom/md5.hpp>
+#include <custom/compact_archive.hpp>
+#include <boost/thread.hpp>
+#include <unordered_map>
+#include <list>
+
+namespace custom
+{
+	class file_cache : boost::noncopyable
+	{
+	private:
+		enum {format_version = 1};
+		struct record
+		{
+			uint64_t	size;
+			int64_t		mtime;
+			string		md5;
+			DECLARE_SERIALIZE(size, mtime, md5)
+		};
+		struct cached_content
+		{
+			std::shared_ptr<const vector<char>>	content;
+			uint64_t							size;
+			int64_t								mtime;
+			std::list<wstring>::iterator		position;
+		};
+		boost::mutex								m;
+		std::unordered_map<wstring, record>			records;
+		std::unordered_map<wstring, cached_content>	contents;
+		std::list<wstring>							recency;
+		size_t										capacity;
+		size_t										used;
+
+		//The paths are compared case insensitively on Windows, thus the key is normalized once instead of comparing with custom::iless.
+		static wstring key_of(const std::experimental::filesystem::path& p)
+		{
+			auto key = fileutility::get_normalized_path(p);
+#ifdef _WIN32
+			boost::algorithm::to_lower(key);
+#endif
+			return key;
+		}
+		static bool status_of(const std::experimental::filesystem::path& p, uint64_t& size, int64_t& mtime)
+		{
+			auto status = fileutility::stat_file(p);
+			size = status.size;
+			mtime = status.mtime;
+			return status.regular();
+		}
+		void remember(const wstring& key, uint64_t size, int64_t mtime, const string& digest)
+		{
+			record r = {size, mtime, digest};
+			DeclareSection(m);
+			records[key] = r;
+		}
+		void cache_content(const wstring& key, uint64_t size, int64_t mtime, const std::shared_ptr<const vector<char>>& content)
+		{
+			if(content->size() > capacity) return;
+			DeclareSection(m);
+			evict(key);
+			recency.push_front(key);
+			cached_content c = {content, size, mtime, recency.begin()};
+			contents[key] = c;
+			used += content->size();
+			while(used > capacity)
+				evict(recency.back());
+		}
+		void evict(const wstring& key)
+		{
+			auto it = contents.find(key);
+			if(contents.end() == it) return;
+			used -= it->second.content->size();
+			recency.erase(it->second.position);
+			contents.erase(it);
+		}
+		//The digest is set only if the content was read from the file, a content served from memory leaves it untouched.
+		std::shared_ptr<const vector<char>> read_imply(const std::experimental::filesystem::path& p, const wstring& key, uint64_t size, int64_t mtime, string& digest)
+		{
+			{
+				DeclareSection(m);
+				auto it = contents.find(key);
+				if(contents.end() != it)
+				{
+					if(it->second.size == size && it->second.mtime == mtime)
+					{
+						recency.splice(recency.begin(), recency, it->second.position);
+						return it->second.content;
+					}
+					evict(key);
+				}
+			}
+			auto content = std::make_shared<vector<char>>(fileutility::read_file(p));
+			digest = custom::md5(*content);
+			remember(key, size, mtime, digest);
+			cache_content(key, size, mtime, content);
+			return content;
+		}
+	public:
+		//content_capacity is the total bytes of the contents kept in memory, 0 disables keeping the contents.
+		explicit file_cache(size_t content_capacity = 0) : capacity(content_capacity), used(0) {}
+
+		//Whether the file has the same size and last write time as when it was hashed.
+		bool unchanged(const std::experimental::filesystem::path& p)
+		{
+			uint64_t size;
+			int64_t mtime;
+			if(false == status_of(p, size, mtime)) return false;
+			auto key = key_of(p);
+			DeclareSection(m);
+			auto it = records.find(key);
+			return records.end() != it && it->second.size == size && it->second.mtime == mtime;
+		}
+		//The content of the file, served from memory if it is cached and unchanged. Returns nullptr if the file can't be read.
+		std::shared_ptr<const vector<char>> read(const std::experimental::filesystem::path& p)
+		{
+			uint64_t size;
+			int64_t mtime;
+			if(false == status_of(p, size, mtime)) return nullptr;
+			string digest;
+			return read_imply(p, key_of(p), size, mtime, digest);
+		}
+		//The md5 of the file, computed only if the file is new or changed. Returns an empty string if the file can't be read.
+		string md5(const std::experimental::filesystem::path& p)
+		{
+			uint64_t size;
+			int64_t mtime;
+			if(false == status_of(p, size, mtime)) return "";
+			auto key = key_of(p);
+			{
+				DeclareSection(m);
+				auto it = records.find(key);
+				if(records.end() != it && it->second.size == size && it->second.mtime == mtime)
+					return it->second.md5;
+			}
+			//A content too large to be kept is streamed through the hasher instead of read into memory.
+			if(size > capacity)
+			{
+				auto digest = custom::md5_file(p);
+				if(false == digest.empty())
+					remember(key, size, mtime, digest);
+				return digest;
+			}
+			//The digest is taken from the read itself, the record may be erased by another thread meanwhile.
+			string digest;
+			auto content = read_imply(p, key, size, mtime, digest);
+			if(nullptr == content) return "";
+			if(digest.empty())
+			{
+				digest = custom::md5(*content);
+				remember(key, size, mtime, digest);
+			}
+			return digest;
+		}
+		//Drops the records and contents of the files, such as the ones deleted.
+		void erase(const std::experimental::filesystem::path& p)
+		{
+			auto key = key_of(p);
+			DeclareSection(m);
+			records.erase(key);
+			evict(key);
+		}
+
+		//The persistence group, only the md5 records are saved.
+		bool load(const std::experimental::filesystem::path& p)
+		{
+			std::ifstream file(p, ios::binary);
+			if(false == file.is_open()) return false;
+			auto ar = make_compact_archive(file);
+			int32_t version = 0;
+			ar >> version;
+			if(format_version != version || file.fail()) return false;
+			std::unordered_map<wstring, record> loaded;
+			ar >> loaded;
+			if(file.fail()) return false;
+			DeclareSection(m);
+			records.swap(loaded);
+			return true;
+		}
+		//Saves through write_file_atomic, so a crash while saving never corrupts the previous records.
+		bool save(const std::experimental::filesystem::path& p)
+		{
+			std::stringstream stream;
+			auto ar = make_compact_archive(stream);
+			int32_t version = format_version;
+			ar << version;
+			{
+				DeclareSection(m);
+				ar << records;
+			}
+			auto data = stream.str();
+			return fileutility::write_file_atomic(p, data.data(), data.size(), fileutility::write_durable);
+		}
+	};
+}
\ No newline at end of file
@@ -9,11 +9,36 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/utility/string_view.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_guard.hpp>
+#include <unordered_map>
+#include <custom/usefulfunctions.hpp>
+#ifdef _WIN32
 #include <custom/runtime_context.hpp>
 #include <shlobj.h>
 #include <filesystem>
 #pragma comment(lib, "Shell32.lib")
+#else
+#include <custom/exceptions.hpp>
+#include <experimental/filesystem>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+#endif
 
 #ifdef _DEBUG
 #pragma comment(linker, "/nodefaultlib:libcmt.lib")
@@ -23,39 +48,77 @@
 
 namespace fileutility
 {
+	//The single-pass normalization group, working in place or on views, thus allocating nothing.
+	//Rewrites the backslashes to '/' and trims one trailing '/' within [first, last), returns the new end.
+	inline wchar_t* normalize_separators(wchar_t* first, wchar_t* last)
+	{
+		for(auto p = first; last != p; ++p)
+		{
+			if(L'\\' == *p)
+				*p = L'/';
+		}
+		if(first != last && L'/' == last[-1])
+			--last;
+		return last;
+	}
+	inline void normalize_separators(wstring& path)
+	{
+		if(path.empty()) return;
+		path.resize(normalize_separators(&path[0], &path[0] + path.size()) - &path[0]);
+	}
+	//The parent of a normalized path, which is always a prefix of it, with the trailing '/' trimmed like get_parent_path does.
+	inline boost::wstring_view parent_view(boost::wstring_view normalized)
+	{
+		auto pos = normalized.rfind(L'/');
+		if(boost::wstring_view::npos == pos)
+			return boost::wstring_view();
+		auto parent = normalized.substr(0, pos);
+		if(false == parent.empty() && L'/' == parent.back())
+			parent.remove_suffix(1);
+		return parent;
+	}
+	//Whether the path is taken as a full path as it is, the same rule get_full_path has always used.
+	inline bool is_full_path(const std::experimental::filesystem::path& name)
+	{
+		auto& native = name.native();
+		return name.empty() || std::find(native.begin(), native.end(), ':') != native.end();
+	}
+
 	inline wstring get_full_path(const std::experimental::filesystem::path& name)
 	{
-		if(boost::algorithm::contains(name.wstring(), L":") || name.empty()) return name.wstring();
-		return boost::algorithm::replace_all_copy(std::experimental::filesystem::absolute(name).wstring(), L"/", L"\\");
+		if(is_full_path(name)) return name.wstring();
+		auto full = std::experimental::filesystem::absolute(name).wstring();
+		std::replace(full.begin(), full.end(), L'/', L'\\');
+		return full;
 	}
 
 	inline wstring get_normalized_path(const std::experimental::filesystem::path& name)
 	{
-		auto npath = get_full_path(name);
-		boost::replace_all(npath, L"\\", L"/");
-		if(boost::iends_with(npath, L"/"))
-			npath.pop_back();
+		auto npath = is_full_path(name) ? name.wstring() : std::experimental::filesystem::absolute(name).wstring();
+		normalize_separators(npath);
 		return npath;
 	}
 	inline wstring get_parent_path(const std::experimental::filesystem::path& path)
 	{
-		auto npath = std::experimental::filesystem::path(get_normalized_path(path)).parent_path();
-		auto wpath = npath.wstring();
-		if(boost::ends_with(wpath, L"/"))
-			wpath.pop_back();
-		return wpath;
+		auto npath = get_normalized_path(path);
+		npath.resize(parent_view(npath).size());
+		return npath;
 	}
+#ifdef _WIN32
+	//Resolves the shell link (.lnk) to its target, any other path is only normalized. COM is only involved for the .lnk files.
 	inline wstring get_real_path(const std::experimental::filesystem::path& name)
-	{ 
+	{
+		wstring			real_path = get_normalized_path(name);
+		if(false == boost::algorithm::iends_with(real_path, L".lnk"))
+			return real_path;
 		HRESULT			result;
 		WCHAR			temp_path[MAX_PATH * 4] = {0};
-		wstring			real_path = get_normalized_path(name);
 		IShellLinkW*	psl;
-		const wchar_t*	key = L"8D411CEB-17C2-4DEF-AA1B-6CB8B93C41F8";
+		static thread_local bool com_initialized = false;
 
-		if(runtime_context::thread::exists(key) == false)
+		if(false == com_initialized)
 		{
-			runtime_context::thread::value(key) = 1;
+			com_initialized = true;
 			CoInitialize(nullptr);
 		}
 		result = CoCreateInstance(CLSID_ShellLink, nullptr, CLSCTX_INPROC_SERVER, IID_IShellLink, (LPVOID*)&psl); 
@@ -78,17 +141,188 @@ namespace fileutility
 		}
 		return get_normalized_path(real_path);
 	}
+#else
+	//The resolved directories by their unresolved paths. An entry is trusted while the unresolved path still leads to a directory of the same identity and last write time,
+	//and the resolved path still names that very directory rather than a link, which is a stat and an lstat in place of the lstat and readlink per component realpath costs.
+	//Thus renaming the directory itself is noticed, even if a link takes its old name. Replacing an ancestor of the resolved directory with a link to the same place is not noticed.
+	class real_path_cache : boost::noncopyable
+	{
+	private:
+		struct entry
+		{
+			std::string	resolved;
+			dev_t		device;
+			ino_t		inode;
+			int64_t		mtime;
+		};
+		boost::mutex							m;
+		std::unordered_map<std::string, entry>	entries;
+		static int64_t mtime_of(const struct stat& status)
+		{
+#if defined(__APPLE__)
+			return (int64_t)status.st_mtimespec.tv_sec * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+			return (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+		}
+	public:
+		static real_path_cache& instance()
+		{
+			static real_path_cache cache;
+			return cache;
+		}
+		//The resolved directory without the trailing '/', thus the root is empty. Returns false if the directory can't be resolved.
+		bool directory(const std::string& path, std::string& resolved)
+		{
+			struct stat status;
+			if(0 != ::stat(path.empty() ? "/" : path.c_str(), &status) || false == S_ISDIR(status.st_mode)) return false;
+			bool cached = false;
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				auto it = entries.find(path);
+				if(entries.end() != it && it->second.device == status.st_dev && it->second.inode == status.st_ino && it->second.mtime == mtime_of(status))
+				{
+					resolved = it->second.resolved;
+					cached = true;
+				}
+			}
+			//The directory renamed and replaced by a link keeps its identity, but its old resolved path is a link now, or gone.
+			struct stat real_status;
+			if(cached && 0 == lstat(resolved.empty() ? "/" : resolved.c_str(), &real_status) && S_ISDIR(real_status.st_mode) && real_status.st_dev == status.st_dev && real_status.st_ino == status.st_ino)
+				return true;
+			std::unique_ptr<char, decltype(&free)> real(realpath(path.empty() ? "/" : path.c_str(), nullptr), &free);
+			if(nullptr == real) return false;
+			resolved = real.get();
+			if("/" == resolved)
+				resolved.clear();
+			entry e = {resolved, status.st_dev, status.st_ino, mtime_of(status)};
+			boost::lock_guard<boost::mutex> lock(m);
+			if(entries.size() >= 1 << 16)
+				entries.clear();
+			entries[path] = e;
+			return true;
+		}
+		void clear()
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			entries.clear();
+		}
+	};
+	//Resolves the symbolic links of the path to the real path. The path which doesn't exist is only normalized.
+	//The directory part is served by real_path_cache, thus resolving many paths in the same tree costs about three stats each, however deep the links are chained.
+	//Unlike realpath, a result may be stale while an ancestor of the resolved directory has been swapped for a link leading to the same directory, see real_path_cache.
+	inline wstring get_real_path(const std::experimental::filesystem::path& name)
+	{
+		auto normalized = get_normalized_path(name);
+		auto path = std::experimental::filesystem::path(normalized).string();
+		std::string resolved;
+		//The same limit of the hops as the kernel has.
+		for(int hops = 0; hops < 40; ++hops)
+		{
+			auto slash = path.rfind('/');
+			std::string leaf = std::string::npos == slash ? path : path.substr(slash + 1);
+			if(std::string::npos == slash || "." == leaf || ".." == leaf || leaf.empty() || false == real_path_cache::instance().directory(path.substr(0, slash), resolved))
+				break;
+			resolved += '/';
+			resolved += leaf;
+			struct stat status;
+			if(0 != lstat(resolved.c_str(), &status))
+				break;
+			if(false == S_ISLNK(status.st_mode))
+				return std::experimental::filesystem::path(resolved).wstring();
+			std::string target((size_t)(std::max)(status.st_size, (off_t)255) + 1, '\0');
+			auto length = readlink(resolved.c_str(), &target[0], target.size());
+			if(0 >= length || (size_t)length >= target.size())
+				break;
+			target.resize((size_t)length);
+			//A relative target is relative to the directory of the link.
+			path = '/' == target[0] ? target : resolved.substr(0, resolved.size() - leaf.size()) + target;
+			while(1 < path.size() && '/' == path.back())
+				path.pop_back();
+		}
+		//The leaf is "." or "..", a link loop, or anything else the cache doesn't cover, which is left to realpath.
+		std::unique_ptr<char, decltype(&free)> real(realpath(path.c_str(), nullptr), &free);
+		return nullptr == real ? normalized : std::experimental::filesystem::path(real.get()).wstring();
+	}
+#endif
+	//The metadata group, each path costs a single system call.
+	enum class entry_type {none, regular, directory, symlink, other};
+	struct file_status
+	{
+		uint64_t	size;
+		int64_t		mtime;		//The last write time in nanoseconds since 1970-01-01 UTC.
+		entry_type	type;		//none if the path doesn't exist or can't be accessed.
+		bool exists()const {return entry_type::none != type;}
+		bool regular()const {return entry_type::regular == type;}
+		bool directory()const {return entry_type::directory == type;}
+	};
+	//The status of the file, following the symbolic links like is_regular_file does.
+	inline file_status stat_file(const std::experimental::filesystem::path& p)
+	{
+		file_status status = {0, 0, entry_type::none};
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(FALSE == GetFileAttributesExW(p.c_str(), GetFileExInfoStandard, &data)) return status;
+		//A reparse point such as a symbolic link is reported with the attributes of the link itself, which is rare enough to pay the slower call.
+		if(FILE_ATTRIBUTE_REPARSE_POINT & data.dwFileAttributes)
+		{
+			auto handle = CreateFileW(p.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+			if(INVALID_HANDLE_VALUE == handle) return status;
+			BY_HANDLE_FILE_INFORMATION information;
+			auto succeeded = GetFileInformationByHandle(handle, &information);
+			CloseHandle(handle);
+			if(FALSE == succeeded) return status;
+			data.dwFileAttributes = information.dwFileAttributes;
+			data.ftLastWriteTime = information.ftLastWriteTime;
+			data.nFileSizeHigh = information.nFileSizeHigh;
+			data.nFileSizeLow = information.nFileSizeLow;
+		}
+		status.type = (FILE_ATTRIBUTE_DIRECTORY & data.dwFileAttributes) ? entry_type::directory : entry_type::regular;
+		status.size = entry_type::regular == status.type ? ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow : 0;
+		//FILETIME counts 100ns since 1601-01-01.
+		status.mtime = ((int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime) - 116444736000000000LL) * 100;
+#else
+		unsigned mode;
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+		//statx fetches only the fields asked for, which spares the file systems computing the rest, such as the block counts.
+		struct statx buffer;
+		if(0 != statx(AT_FDCWD, p.c_str(), 0, STATX_TYPE | STATX_SIZE | STATX_MTIME, &buffer)) return status;
+		mode = buffer.stx_mode;
+		status.size = buffer.stx_size;
+		status.mtime = (int64_t)buffer.stx_mtime.tv_sec * 1000000000 + buffer.stx_mtime.tv_nsec;
+#else
+		struct stat buffer;
+		if(0 != ::stat(p.c_str(), &buffer)) return status;
+		mode = buffer.st_mode;
+		status.size = (uint64_t)buffer.st_size;
+#if defined(__APPLE__)
+		status.mtime = (int64_t)buffer.st_mtimespec.tv_sec * 1000000000 + buffer.st_mtimespec.tv_nsec;
+#else
+		status.mtime = (int64_t)buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+#endif
+#endif
+		status.type = S_ISREG(mode) ? entry_type::regular : S_ISDIR(mode) ? entry_type::directory : S_ISLNK(mode) ? entry_type::symlink : entry_type::other;
+		if(entry_type::regular != status.type)
+			status.size = 0;
+#endif
+		return status;
+	}
+	//The status of many files at once, in the order of the paths. The calls are spread over a few threads, since each of them mostly waits for the file system,
+	//more threads than that only contend on the directory locks of the kernel.
+	inline vector<file_status> stat_files(const vector<std::experimental::filesystem::path>& paths, size_t threads = (std::min)(8u, std::thread::hardware_concurrency()))
+	{
+		vector<file_status> statuses(paths.size());
+		custom::parallel_for(paths.size(), [&](size_t k) {statuses[k] = stat_file(paths[k]);}, threads);
+		return statuses;
+	}
 	inline uint64_t file_size(const std::experimental::filesystem::path& path)
 	{
-		if(std::experimental::filesystem::is_regular_file(path))
-			return std::experimental::filesystem::file_size(path);
-		else
-			return 0;
+		return stat_file(path).size;
 	}
 
 	inline vector<char> read_file(const std::experimental::filesystem::path& p)
 	{
-		ifstream file(p.generic_wstring(), ios::binary);
+		ifstream file(p, ios::binary);
 		auto size = fileutility::file_size(p);
 		vector<char> buffer((size_t)size);
 		if(0 < size)
@@ -97,16 +331,508 @@ namespace fileutility
 		return buffer;
 	}
 
+	//The hint of how a file is going to be accessed, which lets the OS tune the read-ahead.
+	enum class access_hint {normal, sequential, random};
+
+	//The read-only memory mapped view of a file. Unlike read_file, the content is neither copied nor held twice, the pages are loaded on demand.
+	//An absent, empty or unmappable file results in an empty view. The view is unmapped when the object is destroyed.
+	class mapped_file : boost::noncopyable
+	{
+	private:
+		const char*	m_data;
+		size_t		m_size;
+	public:
+		mapped_file() : m_data(nullptr), m_size(0) {}
+		explicit mapped_file(const std::experimental::filesystem::path& p, access_hint hint = access_hint::normal) : m_data(nullptr), m_size(0)
+		{
+			open(p, hint);
+		}
+		mapped_file(mapped_file&& other) : m_data(other.m_data), m_size(other.m_size)
+		{
+			other.m_data = nullptr;
+			other.m_size = 0;
+		}
+		mapped_file& operator = (mapped_file&& other)
+		{
+			if(this != &other)
+			{
+				close();
+				std::swap(m_data, other.m_data);
+				std::swap(m_size, other.m_size);
+			}
+			return *this;
+		}
+		~mapped_file() {close();}
+
+		bool open(const std::experimental::filesystem::path& p, access_hint hint = access_hint::normal)
+		{
+			close();
+#ifdef _WIN32
+			DWORD flags = FILE_ATTRIBUTE_NORMAL;
+			if(access_hint::sequential == hint) flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+			if(access_hint::random == hint) flags |= FILE_FLAG_RANDOM_ACCESS;
+			HANDLE file = CreateFileW(p.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, flags, nullptr);
+			if(INVALID_HANDLE_VALUE == file) return false;
+			LARGE_INTEGER size;
+			if(FALSE == GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart > SIZE_MAX)
+			{
+				CloseHandle(file);
+				return false;
+			}
+			if(0 < size.QuadPart)
+			{
+				//The view keeps the mapping and the file referenced, so both handles can be closed right away.
+				HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if(nullptr != mapping)
+				{
+					m_data = reinterpret_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					CloseHandle(mapping);
+				}
+				if(nullptr != m_data)
+					m_size = (size_t)size.QuadPart;
+			}
+			CloseHandle(file);
+			return 0 == size.QuadPart || nullptr != m_data;
+#else
+			int file = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+			if(0 > file) return false;
+			struct stat status;
+			if(0 != fstat(file, &status) || (uint64_t)status.st_size > SIZE_MAX)
+			{
+				::close(file);
+				return false;
+			}
+			if(0 < status.st_size)
+			{
+				void* address = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+				if(MAP_FAILED != address)
+				{
+					m_data = reinterpret_cast<const char*>(address);
+					m_size = (size_t)status.st_size;
+					advise(hint);
+				}
+			}
+			::close(file);
+			return 0 == status.st_size || nullptr != m_data;
+#endif
+		}
+		void close()
+		{
+			if(nullptr == m_data) return;
+#ifdef _WIN32
+			UnmapViewOfFile(m_data);
+#else
+			munmap(const_cast<char*>(m_data), m_size);
+#endif
+			m_data = nullptr;
+			m_size = 0;
+		}
+		//Changes the hint for the whole view. On Windows the hint only takes effect when opening, since it is a property of the file handle.
+		void advise(access_hint hint)
+		{
+#ifndef _WIN32
+			if(nullptr == m_data) return;
+			int advice = access_hint::sequential == hint ? MADV_SEQUENTIAL : access_hint::random == hint ? MADV_RANDOM : MADV_NORMAL;
+			madvise(const_cast<char*>(m_data), m_size, advice);
+#endif
+		}
+
+		const char* data()const {return m_data;}
+		size_t size()const {return m_size;}
+		bool empty()const {return 0 == m_size;}
+		const char* begin()const {return m_data;}
+		const char* end()const {return m_data + m_size;}
+		const char& operator[](size_t index)const {return m_data[index];}
+	};
+
+	//The heap buffer aligned for the unbuffered I/O, whose addresses and sizes must be multiples of the sector size.
+	class aligned_buffer : boost::noncopyable
+	{
+	private:
+		std::unique_ptr<char[]>	m_storage;
+		char*					m_data;
+		size_t					m_size;
+	public:
+		enum {alignment = 4096};
+		explicit aligned_buffer(size_t size) : m_storage(new char[size + alignment]), m_size(size)
+		{
+			m_data = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(m_storage.get()) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+		}
+		char* data() {return m_data;}
+		size_t size()const {return m_size;}
+		static size_t align_up(size_t size) {return (size + alignment - 1) & ~(size_t)(alignment - 1);}
+	};
+
+	//The thin wrapper of the OS file handle, for the operations the standard streams don't expose, such as preallocation and flushing to the disk.
+	//All the operations return false on failure and never throw.
+	class native_file : boost::noncopyable
+	{
+	public:
+		enum open_mode
+		{
+			open_read = 1,
+			open_write = 2,			//Creates the file, or truncates the existing one.
+			open_direct = 4,		//Bypasses the OS cache, the caller must use aligned_buffer and sector-sized writes.
+			open_sequential = 8,
+		};
+#ifdef _WIN32
+		typedef HANDLE	handle_type;
+		static handle_type invalid_handle() {return INVALID_HANDLE_VALUE;}
+#else
+		typedef int		handle_type;
+		static handle_type invalid_handle() {return -1;}
+#endif
+	private:
+		handle_type	m_handle;
+	public:
+		native_file() : m_handle(invalid_handle()) {}
+		native_file(const std::experimental::filesystem::path& p, int mode) : m_handle(invalid_handle()) {open(p, mode);}
+		native_file(native_file&& other) : m_handle(other.m_handle) {other.m_handle = invalid_handle();}
+		~native_file() {close();}
+		bool is_open()const {return invalid_handle() != m_handle;}
+		handle_type handle()const {return m_handle;}
+
+		bool open(const std::experimental::filesystem::path& p, int mode)
+		{
+			close();
+#ifdef _WIN32
+			DWORD access = (mode & open_read ? GENERIC_READ : 0) | (mode & open_write ? GENERIC_WRITE : 0);
+			DWORD flags = FILE_ATTRIBUTE_NORMAL | (mode & open_direct ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : 0) | (mode & open_sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0);
+			m_handle = CreateFileW(p.wstring().c_str(), access, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, mode & open_write ? CREATE_ALWAYS : OPEN_EXISTING, flags, nullptr);
+#else
+			int flags = O_CLOEXEC | (mode & open_write ? (mode & open_read ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC : O_RDONLY);
+#ifdef O_DIRECT
+			if(mode & open_direct)
+			{
+				m_handle = ::open(p.c_str(), flags | O_DIRECT, 0666);
+				//Some file systems, such as tmpfs, refuse O_DIRECT. Falls back to the buffered I/O, which accepts the aligned requests as well.
+				if(0 <= m_handle || EINVAL != errno)
+					return is_open();
+			}
+#endif
+			m_handle = ::open(p.c_str(), flags, 0666);
+#ifdef POSIX_FADV_SEQUENTIAL
+			if(is_open() && (mode & open_sequential))
+				posix_fadvise(m_handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+			return is_open();
+		}
+		void close()
+		{
+			if(false == is_open()) return;
+#ifdef _WIN32
+			CloseHandle(m_handle);
+#else
+			::close(m_handle);
+#endif
+			m_handle = invalid_handle();
+		}
+		uint64_t size()const
+		{
+#ifdef _WIN32
+			LARGE_INTEGER size;
+			return GetFileSizeEx(m_handle, &size) ? (uint64_t)size.QuadPart : 0;
+#else
+			struct stat status;
+			return 0 == fstat(m_handle, &status) ? (uint64_t)status.st_size : 0;
+#endif
+		}
+		//Reads up to size bytes from the current position, returns the number of bytes read, 0 at the end of the file and -1 on failure.
+		int64_t read(void* buffer, size_t size)
+		{
+#ifdef _WIN32
+			DWORD done = 0;
+			if(FALSE == ReadFile(m_handle, buffer, (DWORD)std::min<size_t>(size, 1 << 30), &done, nullptr)) return -1;
+			return done;
+#else
+			ssize_t done;
+			while(0 > (done = ::read(m_handle, buffer, std::min<size_t>(size, 1 << 30))) && EINTR == errno);
+			return done;
+#endif
+		}
+		//Reads up to size bytes at the offset without moving the current position, with the same return value as read.
+		int64_t read_at(void* buffer, size_t size, uint64_t offset)
+		{
+#ifdef _WIN32
+			OVERLAPPED overlapped = {0};
+			overlapped.Offset = (DWORD)offset;
+			overlapped.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD done = 0;
+			if(FALSE == ReadFile(m_handle, buffer, (DWORD)std::min<size_t>(size, 1 << 30), &done, &overlapped))
+				return ERROR_HANDLE_EOF == GetLastError() ? 0 : -1;
+			return done;
+#else
+			ssize_t done;
+			while(0 > (done = ::pread(m_handle, buffer, std::min<size_t>(size, 1 << 30), (off_t)offset)) && EINTR == errno);
+			return done;
+#endif
+		}
+		//Writes all the bytes at the current position.
+		bool write(const void* buffer, size_t size)
+		{
+			auto p = reinterpret_cast<const char*>(buffer);
+			while(0 < size)
+			{
+#ifdef _WIN32
+				DWORD done = 0;
+				if(FALSE == WriteFile(m_handle, p, (DWORD)std::min<size_t>(size, 1 << 30), &done, nullptr)) return false;
+#else
+				ssize_t done = ::write(m_handle, p, std::min<size_t>(size, 1 << 30));
+				if(0 > done)
+				{
+					if(EINTR == errno) continue;
+					return false;
+				}
+#endif
+				p += done;
+				size -= (size_t)done;
+			}
+			return true;
+		}
+		//Reserves the disk space up to size without changing the file size, it is merely a hint thus failure is harmless.
+		bool allocate(uint64_t size)
+		{
+#ifdef _WIN32
+			FILE_ALLOCATION_INFO info;
+			info.AllocationSize.QuadPart = (LONGLONG)size;
+			return FALSE != SetFileInformationByHandle(m_handle, FileAllocationInfo, &info, sizeof(info));
+#elif defined(__linux__)
+			return 0 == fallocate(m_handle, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#else
+			return false;
+#endif
+		}
+		bool resize(uint64_t size)
+		{
+#ifdef _WIN32
+			FILE_END_OF_FILE_INFO info;
+			info.EndOfFile.QuadPart = (LONGLONG)size;
+			return FALSE != SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &info, sizeof(info));
+#else
+			return 0 == ftruncate(m_handle, (off_t)size);
+#endif
+		}
+		//Flushes the data down to the disk.
+		bool sync()
+		{
+#ifdef _WIN32
+			return FALSE != FlushFileBuffers(m_handle);
+#elif defined(__linux__)
+			return 0 == fdatasync(m_handle);
+#else
+			return 0 == fsync(m_handle);
+#endif
+		}
+	};
+
 	inline void write_file(const std::experimental::filesystem::path& p, const vector<char>& buffer)
 	{
 		std::error_code ec;
 		std::experimental::filesystem::create_directories(std::experimental::filesystem::path(p).parent_path(), ec);
 
-		ofstream file(p.generic_wstring(), ofstream::trunc | ios::binary);
+		ofstream file(p, ofstream::trunc | ios::binary);
 		if(0 < buffer.size())
 			file.write(&buffer[0], buffer.size());
 		file.close();
 	}
+	//The options of write_file_atomic.
+	enum write_flags
+	{
+		write_durable = 1,		//Flushes the data and the rename to the disk before returning, so the file survives a power loss.
+		write_direct = 2,		//Bypasses the OS cache, which only pays off for the large files that won't be read back soon.
+		write_preallocate = 4,	//Reserves the disk space of the whole file up front, which reduces fragmentation.
+	};
+
+	//Writes the content to a temporary file next to the target, then renames it over the target.
+	//Either the old or the new content is visible at any time, a crash never leaves a truncated file. Returns false if anything fails, in which case the target is untouched.
+	inline bool write_file_atomic(const std::experimental::filesystem::path& p, const void* data, size_t size, int flags = write_durable | write_preallocate)
+	{
+		static std::atomic<uint32_t> sequence(0);
+		std::error_code ec;
+		std::experimental::filesystem::create_directories(std::experimental::filesystem::path(p).parent_path(), ec);
+#ifdef _WIN32
+		auto process = (uint32_t)GetCurrentProcessId();
+#else
+		auto process = (uint32_t)getpid();
+#endif
+		auto temp = p;
+		temp += ".tmp." + std::to_string(process) + "." + std::to_string(sequence++);
+
+		native_file file;
+		if(false == file.open(temp, native_file::open_write | (flags & write_direct ? native_file::open_direct : 0)))
+			return false;
+		bool succeeded = true;
+#ifndef _WIN32
+		//The temporary file replaces the target, thus it takes over the mode of an existing target, and its owner where the process is permitted to change it.
+		//A new target is created with 0666 less the umask, as ofstream does.
+		struct stat existing;
+		if(0 == stat(p.c_str(), &existing))
+		{
+			if(0 != fchown(file.handle(), existing.st_uid, existing.st_gid) && EPERM != errno)
+				succeeded = false;
+			succeeded = succeeded && 0 == fchmod(file.handle(), existing.st_mode & 07777);
+		}
+#endif
+		if(flags & write_preallocate)
+			file.allocate(size);
+		if(flags & write_direct)
+		{
+			//The unbuffered writes must be aligned, thus the content goes through an aligned buffer, and the padding of the last block is cut off afterwards.
+			aligned_buffer chunk(std::min<size_t>(aligned_buffer::align_up(size), 4 << 20));
+			for(size_t offset = 0; succeeded && offset < size; offset += chunk.size())
+			{
+				size_t length = (std::min)(chunk.size(), size - offset);
+				memcpy(chunk.data(), reinterpret_cast<const char*>(data) + offset, length);
+				memset(chunk.data() + length, 0, aligned_buffer::align_up(length) - length);
+				succeeded = file.write(chunk.data(), aligned_buffer::align_up(length));
+			}
+			succeeded = succeeded && file.resize(size);
+		}
+		else
+			succeeded = succeeded && file.write(data, size);
+		if(flags & write_durable)
+			succeeded = succeeded && file.sync();
+		file.close();
+
+#ifdef _WIN32
+		succeeded = succeeded && FALSE != MoveFileExW(temp.wstring().c_str(), p.wstring().c_str(), MOVEFILE_REPLACE_EXISTING | (flags & write_durable ? MOVEFILE_WRITE_THROUGH : 0));
+		if(false == succeeded)
+			DeleteFileW(temp.wstring().c_str());
+#else
+		succeeded = succeeded && 0 == rename(temp.c_str(), p.c_str());
+		if(false == succeeded)
+			unlink(temp.c_str());
+		else if(flags & write_durable)
+		{
+			//The rename itself is only durable once the directory is flushed.
+			auto folder = std::experimental::filesystem::path(p).parent_path();
+			int directory = ::open(folder.empty() ? "." : folder.c_str(), O_RDONLY | O_CLOEXEC);
+			if(0 <= directory)
+			{
+				fsync(directory);
+				::close(directory);
+			}
+		}
+#endif
+		return succeeded;
+	}
+	inline bool write_file_atomic(const std::experimental::filesystem::path& p, const vector<char>& buffer, int flags = write_durable | write_preallocate)
+	{
+		return write_file_atomic(p, buffer.data(), buffer.size(), flags);
+	}
+#ifndef _WIN32
+	//Copies [offset, offset + length) to the same position of the target, letting the kernel move the data if it can.
+	inline bool copy_file_range_imply(int source, int target, uint64_t offset, uint64_t length)
+	{
+		auto in = (off_t)offset, out = (off_t)offset;
+		auto last = in + (off_t)length;
+#ifdef __linux__
+		//copy_file_range stays in the kernel and may even share the extents on the file systems such as NFS or XFS. It refuses the copies across file systems on the older kernels.
+		while(in < last)
+		{
+			auto done = ::copy_file_range(source, &in, target, &out, (size_t)(std::min)(last - in, (off_t)1 << 30), 0);
+			if(0 < done) continue;
+			if(0 == done || EINTR != errno) break;
+		}
+		if(in == last) return true;
+		//sendfile also stays in the kernel, but writes at the position of the target.
+		if(out == lseek(target, out, SEEK_SET))
+		{
+			while(in < last)
+			{
+				auto done = ::sendfile(target, source, &in, (size_t)(std::min)(last - in, (off_t)1 << 30));
+				if(0 < done) continue;
+				if(0 == done || EINTR != errno) break;
+			}
+			out = in;
+			if(in == last) return true;
+			//sendfile may have moved some bytes before failing, the rest goes through the buffer.
+		}
+#endif
+		aligned_buffer buffer(1 << 20);
+		while(in < last)
+		{
+			auto done = ::pread(source, buffer.data(), (size_t)(std::min)(last - in, (off_t)buffer.size()), in);
+			if(0 > done && EINTR == errno) continue;
+			if(0 >= done) return false;
+			for(ssize_t written = 0, length; written < done; written += length)
+			{
+				while(0 > (length = ::pwrite(target, buffer.data() + written, (size_t)(done - written), out + written)) && EINTR == errno);
+				if(0 > length) return false;
+			}
+			in += done;
+			out += done;
+		}
+		return true;
+	}
+	//Copies only the data regions and extends the target to the size, thus the holes are skipped.
+	inline bool copy_sparse_imply(int source, int target, uint64_t size)
+	{
+#ifdef SEEK_HOLE
+		bool succeeded = true;
+		off_t data = 0, hole;
+		while(succeeded && 0 <= (data = lseek(source, data, SEEK_DATA)) && (uint64_t)data < size)
+		{
+			hole = lseek(source, data, SEEK_HOLE);
+			if(0 > hole) hole = (off_t)size;
+			succeeded = copy_file_range_imply(source, target, (uint64_t)data, (uint64_t)(hole - data));
+			data = hole;
+		}
+		//ENXIO means there is no data past the offset, anything else means the file system can't tell the holes.
+		if(succeeded && 0 > data && ENXIO != errno)
+			return copy_file_range_imply(source, target, 0, size);
+		return succeeded && 0 == ftruncate(target, (off_t)size);
+#else
+		return copy_file_range_imply(source, target, 0, size);
+#endif
+	}
+#endif
+	//Copies the file without moving the content through the user space where the OS allows, the target is overwritten.
+	//On Linux the file is cloned if the file system supports the reflinks (Btrfs, XFS), otherwise only the data regions are copied in the kernel, so the holes of a sparse file stay holes.
+	//The other systems copy through a large buffer. Returns false if anything fails, in which case a target created by the call is removed.
+	//Copying a file onto itself, through the same path, a link or another spelling, fails without touching it.
+	inline bool copy_file(const std::experimental::filesystem::path& from, const std::experimental::filesystem::path& to)
+	{
+		std::error_code ec;
+		std::experimental::filesystem::create_directories(std::experimental::filesystem::path(to).parent_path(), ec);
+#ifdef _WIN32
+		//CopyFileExW already copies in the kernel and clones the blocks on ReFS, and refuses to copy a file onto itself.
+		bool created = INVALID_FILE_ATTRIBUTES == GetFileAttributesW(to.wstring().c_str());
+		bool succeeded = FALSE != CopyFileExW(from.wstring().c_str(), to.wstring().c_str(), nullptr, nullptr, nullptr, 0);
+		if(false == succeeded && created)
+			DeleteFileW(to.wstring().c_str());
+		return succeeded;
+#else
+		native_file source(from, native_file::open_read | native_file::open_sequential);
+		struct stat status;
+		if(false == source.is_open() || 0 != fstat(source.handle(), &status)) return false;
+		//An existing target is opened without truncating, and only emptied once it is known to be another file than the source.
+		int target = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, status.st_mode & 0777);
+		bool created = 0 <= target;
+		if(false == created && EEXIST == errno)
+			target = ::open(to.c_str(), O_WRONLY | O_CLOEXEC);
+		if(0 > target) return false;
+		struct stat existing;
+		if(false == created && (0 != fstat(target, &existing) || (existing.st_dev == status.st_dev && existing.st_ino == status.st_ino) || 0 != ftruncate(target, 0)))
+		{
+			::close(target);
+			return false;
+		}
+		auto size = (uint64_t)status.st_size;
+		bool succeeded = false;
+#ifdef FICLONE
+		succeeded = 0 == ioctl(target, FICLONE, source.handle());
+#endif
+		//Fewer blocks than the size needs means there are holes.
+		if(false == succeeded)
+			succeeded = (uint64_t)status.st_blocks * 512 < size ? copy_sparse_imply(source.handle(), target, size) : copy_file_range_imply(source.handle(), target, 0, size);
+		succeeded = 0 == ::close(target) && succeeded;
+		if(false == succeeded && created)
+			unlink(to.c_str());
+		return succeeded;
+#endif
+	}
 	inline wstring remove_extension(const std::experimental::filesystem::path& name)
 	{
 		auto rem = name.wstring();
@@ -121,11 +847,10 @@ namespace fileutility
 	}
 	inline 	wstring relative_path(const std::experimental::filesystem::path& folder, const std::experimental::filesystem::path& path)
 	{
-		auto base = fileutility::get_normalized_path(folder) + L"/";
+		auto base = fileutility::get_normalized_path(folder);
 		auto npath = fileutility::get_normalized_path(path);
-		if(boost::istarts_with(npath, base))
-			return npath.substr(base.size());
-		else
-			return npath;
+		if(base.size() < npath.size() && L'/' == npath[base.size()] && boost::istarts_with(npath, base))
+			npath.erase(0, base.size() + 1);
+		return npath;
 	}
 }
\ No newline at end of file
@@ -1,9 +1,10 @@
 #pragma once
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK	1
 #include <custom/codepage.hpp>
+#include <custom/md5_batch.hpp>
+#include <custom/chunked_file.hpp>
 #include <crypto++/cryptlib.h>
 #include <crypto++/md5.h>
-#include <boost/format.hpp>
 #include <array>
 using namespace std;
 #ifdef _DEBUG
@@ -14,19 +15,45 @@ using namespace std;
 
 namespace custom
 {
+	//Hashes a message fed piece by piece, so the message never has to be in memory at once.
+	class md5_hasher
+	{
+	private:
+		CryptoPP::Weak::MD5	m_md5;
+	public:
+		void update(const void* data, size_t size)
+		{
+			m_md5.Update(reinterpret_cast<const unsigned char*>(data), size);
+		}
+		//The raw digest of everything fed so far. The hasher starts over afterwards.
+		md5_digest final()
+		{
+			md5_digest digest;
+			m_md5.Final(digest.data());
+			return digest;
+		}
+	};
+
+	inline md5_digest md5_digest_of(const void* data, size_t size)
+	{
+		md5_hasher hasher;
+		hasher.update(data, size);
+		return hasher.final();
+	}
 	inline string md5(const void* data, size_t size)
 	{
-		using namespace CryptoPP::Weak;
-		array<byte, 16> m;
-		MD5 md5;
-		md5.Update(reinterpret_cast<const byte*>(data), size);
-		md5.Final(m.data());
-		std::reverse(m.begin(), m.end());
-		return (boost::format("%016X%016X") % *reinterpret_cast<uint64_t*>(&m[8]) % *reinterpret_cast<uint64_t*>(&m[0])).str();
+		return md5_hex(md5_digest_of(data, size));
 	}
 	template<typename Container>
 	inline string md5(const Container& content)
 	{
-		return md5(content.data(), content.size() * sizeof(Container::value_type));
+		return md5(content.data(), content.size() * sizeof(typename Container::value_type));
+	}
+	//The md5 of the file streamed through fileutility::for_each_chunk, in constant memory however large the file is. Returns an empty string if the file can't be read.
+	inline string md5_file(const std::experimental::filesystem::path& p, std::shared_ptr<fileutility::buffer_pool> buffers = fileutility::buffer_pool::create())
+	{
+		md5_hasher hasher;
+		if(false == fileutility::for_each_chunk(p, [&](const char* data, size_t size) {hasher.update(data, size);}, buffers)) return "";
+		return md5_hex(hasher.final());
 	}
 }
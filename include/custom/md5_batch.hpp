@@ -0,0 +1,263 @@
+/*
+	This library hashes many independent messages with MD5 at once, one message per SIMD lane: 4 lanes with SSE2, 8 with AVX2 and 16 with AVX-512, whichever the compiler targets.
+	MD5 itself is strictly sequential within a message, thus the lanes are the only way to put the vector units to work, which pays off the most for the many small messages such as the dedup keys.
+	A lane takes the next message as soon as it finishes its current one, so the messages of different sizes keep all the lanes busy.
+
+	The digests are the same as custom::md5 computes, and md5_hex formats them the same way.
+
+	Here goes an example:
+
+	std::vector<std::string> blobs = ...;
+	auto digests = custom::md5_many(blobs);		//The uppercase hex strings, in the order of the blobs.
+*/
+
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#include <emmintrin.h>
+#define MD5_BATCH_SSE2	1
+#endif
+
+namespace custom
+{
+	typedef std::array<unsigned char, 16> md5_digest;
+
+	//The uppercase hex of the digest, the same format custom::md5 returns.
+	inline std::string md5_hex(const md5_digest& digest)
+	{
+		static const char digits[] = "0123456789ABCDEF";
+		std::string hex(32, '0');
+		for(size_t k = 0; k < 16; ++k)
+		{
+			hex[k * 2] = digits[digest[k] >> 4];
+			hex[k * 2 + 1] = digits[digest[k] & 0x0F];
+		}
+		return hex;
+	}
+
+	//The lane group, each offers the 32-bit operations MD5 needs on its own vector type.
+	struct md5_scalar_lanes
+	{
+		enum {width = 1};
+		typedef uint32_t vector;
+		static vector load(const uint32_t* p) {return *p;}
+		static void store(uint32_t* p, vector v) {*p = v;}
+		static vector set1(uint32_t v) {return v;}
+		static vector add(vector a, vector b) {return a + b;}
+		static vector f(vector b, vector c, vector d) {return d ^ (b & (c ^ d));}
+		static vector g(vector b, vector c, vector d) {return c ^ (d & (b ^ c));}
+		static vector h(vector b, vector c, vector d) {return b ^ c ^ d;}
+		static vector i(vector b, vector c, vector d) {return c ^ (b | ~d);}
+		template<int N> static vector rotate(vector v) {return (v << N) | (v >> (32 - N));}
+	};
+#if defined(MD5_BATCH_SSE2)
+	struct md5_sse2_lanes
+	{
+		enum {width = 4};
+		typedef __m128i vector;
+		static vector load(const uint32_t* p) {return _mm_load_si128(reinterpret_cast<const __m128i*>(p));}
+		static void store(uint32_t* p, vector v) {_mm_store_si128(reinterpret_cast<__m128i*>(p), v);}
+		static vector set1(uint32_t v) {return _mm_set1_epi32((int)v);}
+		static vector add(vector a, vector b) {return _mm_add_epi32(a, b);}
+		static vector f(vector b, vector c, vector d) {return _mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d)));}
+		static vector g(vector b, vector c, vector d) {return _mm_xor_si128(c, _mm_and_si128(d, _mm_xor_si128(b, c)));}
+		static vector h(vector b, vector c, vector d) {return _mm_xor_si128(_mm_xor_si128(b, c), d);}
+		static vector i(vector b, vector c, vector d) {return _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, _mm_set1_epi32(-1))));}
+		template<int N> static vector rotate(vector v) {return _mm_or_si128(_mm_slli_epi32(v, N), _mm_srli_epi32(v, 32 - N));}
+	};
+#endif
+#if defined(__AVX2__)
+	struct md5_avx2_lanes
+	{
+		enum {width = 8};
+		typedef __m256i vector;
+		static vector load(const uint32_t* p) {return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));}
+		static void store(uint32_t* p, vector v) {_mm256_store_si256(reinterpret_cast<__m256i*>(p), v);}
+		static vector set1(uint32_t v) {return _mm256_set1_epi32((int)v);}
+		static vector add(vector a, vector b) {return _mm256_add_epi32(a, b);}
+		static vector f(vector b, vector c, vector d) {return _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));}
+		static vector g(vector b, vector c, vector d) {return _mm256_xor_si256(c, _mm256_and_si256(d, _mm256_xor_si256(b, c)));}
+		static vector h(vector b, vector c, vector d) {return _mm256_xor_si256(_mm256_xor_si256(b, c), d);}
+		static vector i(vector b, vector c, vector d) {return _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, _mm256_set1_epi32(-1))));}
+		template<int N> static vector rotate(vector v) {return _mm256_or_si256(_mm256_slli_epi32(v, N), _mm256_srli_epi32(v, 32 - N));}
+	};
+#endif
+#if defined(__AVX512F__)
+	struct md5_avx512_lanes
+	{
+		enum {width = 16};
+		typedef __m512i vector;
+		static vector load(const uint32_t* p) {return _mm512_load_si512(p);}
+		static void store(uint32_t* p, vector v) {_mm512_store_si512(p, v);}
+		static vector set1(uint32_t v) {return _mm512_set1_epi32((int)v);}
+		static vector add(vector a, vector b) {return _mm512_add_epi32(a, b);}
+		//The ternary logic takes the truth table of the function over (b, c, d) as the immediate.
+		static vector f(vector b, vector c, vector d) {return _mm512_ternarylogic_epi32(b, c, d, 0xCA);}
+		static vector g(vector b, vector c, vector d) {return _mm512_ternarylogic_epi32(b, c, d, 0xE4);}
+		static vector h(vector b, vector c, vector d) {return _mm512_ternarylogic_epi32(b, c, d, 0x96);}
+		static vector i(vector b, vector c, vector d) {return _mm512_ternarylogic_epi32(b, c, d, 0x39);}
+		template<int N> static vector rotate(vector v) {return _mm512_rol_epi32(v, N);}
+	};
+	typedef md5_avx512_lanes	md5_widest_lanes;
+#elif defined(__AVX2__)
+	typedef md5_avx2_lanes		md5_widest_lanes;
+#elif defined(MD5_BATCH_SSE2)
+	typedef md5_sse2_lanes		md5_widest_lanes;
+#else
+	typedef md5_scalar_lanes	md5_widest_lanes;
+#endif
+
+	//Runs the 64 steps over one block of each lane. The words are transposed, words[k] holds the kth word of the block of every lane.
+	template<typename Lanes>
+	inline void md5_compress_imply(uint32_t (&state)[4][Lanes::width], const uint32_t (&words)[16][Lanes::width])
+	{
+		typedef typename Lanes::vector vector;
+		vector a = Lanes::load(state[0]), b = Lanes::load(state[1]), c = Lanes::load(state[2]), d = Lanes::load(state[3]);
+		vector a0 = a, b0 = b, c0 = c, d0 = d;
+#define MD5_STEP(function, a, b, c, d, k, constant, shift)	a = Lanes::add(b, Lanes::template rotate<shift>(Lanes::add(Lanes::add(a, Lanes::function(b, c, d)), Lanes::add(Lanes::set1(constant), Lanes::load(words[k])))))
+		MD5_STEP(f, a, b, c, d, 0, 0xd76aa478, 7);	MD5_STEP(f, d, a, b, c, 1, 0xe8c7b756, 12);	MD5_STEP(f, c, d, a, b, 2, 0x242070db, 17);	MD5_STEP(f, b, c, d, a, 3, 0xc1bdceee, 22);
+		MD5_STEP(f, a, b, c, d, 4, 0xf57c0faf, 7);	MD5_STEP(f, d, a, b, c, 5, 0x4787c62a, 12);	MD5_STEP(f, c, d, a, b, 6, 0xa8304613, 17);	MD5_STEP(f, b, c, d, a, 7, 0xfd469501, 22);
+		MD5_STEP(f, a, b, c, d, 8, 0x698098d8, 7);	MD5_STEP(f, d, a, b, c, 9, 0x8b44f7af, 12);	MD5_STEP(f, c, d, a, b, 10, 0xffff5bb1, 17);	MD5_STEP(f, b, c, d, a, 11, 0x895cd7be, 22);
+		MD5_STEP(f, a, b, c, d, 12, 0x6b901122, 7);	MD5_STEP(f, d, a, b, c, 13, 0xfd987193, 12);	MD5_STEP(f, c, d, a, b, 14, 0xa679438e, 17);	MD5_STEP(f, b, c, d, a, 15, 0x49b40821, 22);
+		MD5_STEP(g, a, b, c, d, 1, 0xf61e2562, 5);	MD5_STEP(g, d, a, b, c, 6, 0xc040b340, 9);	MD5_STEP(g, c, d, a, b, 11, 0x265e5a51, 14);	MD5_STEP(g, b, c, d, a, 0, 0xe9b6c7aa, 20);
+		MD5_STEP(g, a, b, c, d, 5, 0xd62f105d, 5);	MD5_STEP(g, d, a, b, c, 10, 0x02441453, 9);	MD5_STEP(g, c, d, a, b, 15, 0xd8a1e681, 14);	MD5_STEP(g, b, c, d, a, 4, 0xe7d3fbc8, 20);
+		MD5_STEP(g, a, b, c, d, 9, 0x21e1cde6, 5);	MD5_STEP(g, d, a, b, c, 14, 0xc33707d6, 9);	MD5_STEP(g, c, d, a, b, 3, 0xf4d50d87, 14);	MD5_STEP(g, b, c, d, a, 8, 0x455a14ed, 20);
+		MD5_STEP(g, a, b, c, d, 13, 0xa9e3e905, 5);	MD5_STEP(g, d, a, b, c, 2, 0xfcefa3f8, 9);	MD5_STEP(g, c, d, a, b, 7, 0x676f02d9, 14);	MD5_STEP(g, b, c, d, a, 12, 0x8d2a4c8a, 20);
+		MD5_STEP(h, a, b, c, d, 5, 0xfffa3942, 4);	MD5_STEP(h, d, a, b, c, 8, 0x8771f681, 11);	MD5_STEP(h, c, d, a, b, 11, 0x6d9d6122, 16);	MD5_STEP(h, b, c, d, a, 14, 0xfde5380c, 23);
+		MD5_STEP(h, a, b, c, d, 1, 0xa4beea44, 4);	MD5_STEP(h, d, a, b, c, 4, 0x4bdecfa9, 11);	MD5_STEP(h, c, d, a, b, 7, 0xf6bb4b60, 16);	MD5_STEP(h, b, c, d, a, 10, 0xbebfbc70, 23);
+		MD5_STEP(h, a, b, c, d, 13, 0x289b7ec6, 4);	MD5_STEP(h, d, a, b, c, 0, 0xeaa127fa, 11);	MD5_STEP(h, c, d, a, b, 3, 0xd4ef3085, 16);	MD5_STEP(h, b, c, d, a, 6, 0x04881d05, 23);
+		MD5_STEP(h, a, b, c, d, 9, 0xd9d4d039, 4);	MD5_STEP(h, d, a, b, c, 12, 0xe6db99e5, 11);	MD5_STEP(h, c, d, a, b, 15, 0x1fa27cf8, 16);	MD5_STEP(h, b, c, d, a, 2, 0xc4ac5665, 23);
+		MD5_STEP(i, a, b, c, d, 0, 0xf4292244, 6);	MD5_STEP(i, d, a, b, c, 7, 0x432aff97, 10);	MD5_STEP(i, c, d, a, b, 14, 0xab9423a7, 15);	MD5_STEP(i, b, c, d, a, 5, 0xfc93a039, 21);
+		MD5_STEP(i, a, b, c, d, 12, 0x655b59c3, 6);	MD5_STEP(i, d, a, b, c, 3, 0x8f0ccc92, 10);	MD5_STEP(i, c, d, a, b, 10, 0xffeff47d, 15);	MD5_STEP(i, b, c, d, a, 1, 0x85845dd1, 21);
+		MD5_STEP(i, a, b, c, d, 8, 0x6fa87e4f, 6);	MD5_STEP(i, d, a, b, c, 15, 0xfe2ce6e0, 10);	MD5_STEP(i, c, d, a, b, 6, 0xa3014314, 15);	MD5_STEP(i, b, c, d, a, 13, 0x4e0811a1, 21);
+		MD5_STEP(i, a, b, c, d, 4, 0xf7537e82, 6);	MD5_STEP(i, d, a, b, c, 11, 0xbd3af235, 10);	MD5_STEP(i, c, d, a, b, 2, 0x2ad7d2bb, 15);	MD5_STEP(i, b, c, d, a, 9, 0xeb86d391, 21);
+#undef MD5_STEP
+		Lanes::store(state[0], Lanes::add(a, a0));
+		Lanes::store(state[1], Lanes::add(b, b0));
+		Lanes::store(state[2], Lanes::add(c, c0));
+		Lanes::store(state[3], Lanes::add(d, d0));
+	}
+
+	//Hashes the messages through the lanes, out[k] receives the digest of the kth message.
+	template<typename Lanes>
+	inline void md5_many_imply(const void* const* data, const size_t* sizes, size_t count, md5_digest* out)
+	{
+		enum {width = Lanes::width};
+		struct lane
+		{
+			size_t					message;
+			const unsigned char*	next;			//The next block, in the message or in tail.
+			size_t					full_blocks;	//The full blocks left in the message.
+			size_t					tail_blocks;	//The padded blocks left in tail, 1 or 2.
+			unsigned char			tail[128];		//The rest of the message, the 0x80, the zeros and the length in bits.
+		};
+		static const unsigned char idle[64] = {0};
+		lane lanes[width];
+		alignas(64) uint32_t state[4][width];
+		alignas(64) uint32_t words[16][width];
+		size_t assigned = 0, active = 0;
+		auto assign = [&](lane& l, int index)
+		{
+			if(assigned == count)
+			{
+				l.message = count;
+				return;
+			}
+			l.message = assigned++;
+			auto p = reinterpret_cast<const unsigned char*>(data[l.message]);
+			auto size = sizes[l.message];
+			l.full_blocks = size / 64;
+			l.next = 0 < l.full_blocks ? p : l.tail;
+			size_t rest = size % 64;
+			l.tail_blocks = rest + 9 <= 64 ? 1 : 2;
+			memset(l.tail, 0, sizeof(l.tail));
+			if(0 < rest)
+				memcpy(l.tail, p + size - rest, rest);
+			l.tail[rest] = 0x80;
+			uint64_t bits = (uint64_t)size * 8;
+			for(int k = 0; k < 8; ++k)
+				l.tail[l.tail_blocks * 64 - 8 + k] = (unsigned char)(bits >> (k * 8));
+			state[0][index] = 0x67452301;
+			state[1][index] = 0xefcdab89;
+			state[2][index] = 0x98badcfe;
+			state[3][index] = 0x10325476;
+			++active;
+		};
+		for(int k = 0; k < width; ++k)
+			assign(lanes[k], k);
+		while(0 < active)
+		{
+			for(int k = 0; k < width; ++k)
+			{
+				auto& l = lanes[k];
+				const unsigned char* block = idle;
+				if(count != l.message)
+				{
+					block = l.next;
+					l.next += 64;
+				}
+				for(int w = 0; w < 16; ++w)
+					memcpy(&words[w][k], block + w * 4, 4);
+			}
+			md5_compress_imply<Lanes>(state, words);
+			for(int k = 0; k < width; ++k)
+			{
+				auto& l = lanes[k];
+				if(count == l.message) continue;
+				if(0 < l.full_blocks)
+				{
+					//The message switches to the padded tail right after its last full block.
+					if(0 == --l.full_blocks)
+						l.next = l.tail;
+					continue;
+				}
+				if(0 < --l.tail_blocks) continue;
+				for(int r = 0; r < 4; ++r)
+				{
+					for(int b = 0; b < 4; ++b)
+						out[l.message][r * 4 + b] = (unsigned char)(state[r][k] >> (b * 8));
+				}
+				--active;
+				assign(l, k);
+			}
+		}
+	}
+
+	//Hashes count messages at once, data[k] of sizes[k] bytes results in out[k].
+	inline void md5_many(const void* const* data, const size_t* sizes, size_t count, md5_digest* out)
+	{
+		md5_many_imply<md5_widest_lanes>(data, sizes, count, out);
+	}
+	//The raw digests of the contents, in their order. Container is any contiguous container, such as std::string or std::vector<char>.
+	template<typename Container>
+	inline std::vector<md5_digest> md5_digests(const std::vector<Container>& contents)
+	{
+		std::vector<const void*> data(contents.size());
+		std::vector<size_t> sizes(contents.size());
+		for(size_t k = 0; k < contents.size(); ++k)
+		{
+			data[k] = contents[k].data();
+			sizes[k] = contents[k].size() * sizeof(typename Container::value_type);
+		}
+		std::vector<md5_digest> digests(contents.size());
+		md5_many(data.data(), sizes.data(), contents.size(), digests.data());
+		return digests;
+	}
+	//The uppercase hex digests of the contents, the same as calling custom::md5 on each of them.
+	template<typename Container>
+	inline std::vector<std::string> md5_many(const std::vector<Container>& contents)
+	{
+		std::vector<std::string> hexes;
+		hexes.reserve(contents.size());
+		for(auto& digest : md5_digests(contents))
+			hexes.push_back(md5_hex(digest));
+		return hexes;
+	}
+}
\ No newline at end of file
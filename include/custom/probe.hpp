@@ -0,0 +1,190 @@
+/*
+	This library offers latency probes which are cheap enough to stay in the hot paths of the production code.
+	A probe measures the lifetime of its scope on the monotonic clock and records it into the histogram named by the probe.
+	Recording is lock free, the histogram keeps log-linear buckets (8 per power of two, thus at most 12.5% error) instead of the samples themselves.
+
+	Here goes an example:
+
+	void hot_function()
+	{
+		DeclareProbe(L"hot_function");	//The histogram is looked up only once per call site.
+		...
+	}
+
+	//Dump all the histograms on demand, such as from a diagnostic command.
+	debug::od(custom::probe_registry::dump());
+*/
+
+#pragma once
+#include <custom/usefultypes.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define	DeclareProbe(name)	static auto& __a7031x_probe_histogram = custom::probe_registry::histogram(name); custom::scoped_probe __a7031x_scoped_probe(__a7031x_probe_histogram)
+
+namespace custom
+{
+	struct latency_summary
+	{
+		uint64_t	count;
+		uint64_t	mean;
+		uint64_t	p50;
+		uint64_t	p99;
+		uint64_t	max;
+	};
+
+	//All the values are in nanoseconds.
+	class latency_histogram : boost::noncopyable
+	{
+	private:
+		enum {sub_bits = 3, sub_count = 1 << sub_bits, bucket_count = (64 - sub_bits + 1) * sub_count};
+		std::atomic<uint64_t>	buckets[bucket_count];
+		std::atomic<uint64_t>	count;
+		std::atomic<uint64_t>	sum;
+		std::atomic<uint64_t>	maximum;
+
+		static int highest_bit(uint64_t v)
+		{
+#if defined(_MSC_VER) && defined(_M_X64)
+			unsigned long index;
+			_BitScanReverse64(&index, v);
+			return (int)index;
+#elif defined(__GNUC__)
+			return 63 - __builtin_clzll(v);
+#else
+			int index = 0;
+			while(v >>= 1) ++index;
+			return index;
+#endif
+		}
+		static size_t bucket_of(uint64_t v)
+		{
+			if(v < sub_count) return (size_t)v;
+			int msb = highest_bit(v);
+			return ((size_t)(msb - sub_bits + 1) << sub_bits) | (size_t)((v >> (msb - sub_bits)) & (sub_count - 1));
+		}
+		static uint64_t upper_bound_of(size_t bucket)
+		{
+			if(bucket < sub_count) return bucket;
+			int shift = (int)(bucket >> sub_bits) - 1;
+			return ((sub_count + (bucket & (sub_count - 1)) + 1) << shift) - 1;
+		}
+	public:
+		latency_histogram() {reset();}
+		void record(uint64_t nanoseconds)
+		{
+			buckets[bucket_of(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+			count.fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+			auto current = maximum.load(std::memory_order_relaxed);
+			while(current < nanoseconds && false == maximum.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed));
+		}
+		void reset()
+		{
+			for(auto& bucket : buckets)
+				bucket.store(0, std::memory_order_relaxed);
+			count.store(0, std::memory_order_relaxed);
+			sum.store(0, std::memory_order_relaxed);
+			maximum.store(0, std::memory_order_relaxed);
+		}
+		//The summary is computed from a snapshot taken bucket by bucket, which is consistent enough while the recording goes on.
+		latency_summary summary()const
+		{
+			std::vector<uint64_t> snapshot(bucket_count);
+			uint64_t total = 0;
+			for(size_t k = 0; k < bucket_count; ++k)
+				total += snapshot[k] = buckets[k].load(std::memory_order_relaxed);
+			latency_summary s = {total, 0, 0, 0, maximum.load(std::memory_order_relaxed)};
+			if(0 == total) return s;
+			s.mean = sum.load(std::memory_order_relaxed) / std::max<uint64_t>(total, count.load(std::memory_order_relaxed));
+			auto percentile = [&](double p)->uint64_t
+			{
+				uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p * total)), seen = 0;
+				for(size_t k = 0; k < bucket_count; ++k)
+				{
+					seen += snapshot[k];
+					if(seen >= rank)
+						return (std::min)(upper_bound_of(k), s.max);
+				}
+				return s.max;
+			};
+			s.p50 = percentile(0.50);
+			s.p99 = percentile(0.99);
+			return s;
+		}
+	};
+
+	//Records the lifetime of the scope into the histogram.
+	class scoped_probe : boost::noncopyable
+	{
+	private:
+		latency_histogram&						histogram;
+		progress_timer::clock::time_point		start_time;
+	public:
+		scoped_probe(latency_histogram& h) : histogram(h), start_time(progress_timer::clock::now()) {}
+		~scoped_probe()
+		{
+			histogram.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(progress_timer::clock::now() - start_time).count());
+		}
+	};
+
+	//The named histograms of the module. The histograms are never removed, so the references handed out stay valid.
+	class probe_registry
+	{
+	private:
+		struct registry_imply
+		{
+			boost::mutex	m;
+			std::map<std::wstring, std::unique_ptr<latency_histogram>, custom::iless>	histograms;
+		};
+		static registry_imply& instance()
+		{
+			static registry_imply registry;
+			return registry;
+		}
+	public:
+		static latency_histogram& histogram(const std::wstring& name)
+		{
+			auto& registry = instance();
+			DeclareSection(registry.m);
+			auto& h = registry.histograms[name];
+			if(nullptr == h)
+				h.reset(new latency_histogram);
+			return *h;
+		}
+		static std::map<std::wstring, latency_summary, custom::iless> snapshot()
+		{
+			auto& registry = instance();
+			DeclareSection(registry.m);
+			std::map<std::wstring, latency_summary, custom::iless> summaries;
+			for(auto& item : registry.histograms)
+				summaries[item.first] = item.second->summary();
+			return summaries;
+		}
+		static void reset()
+		{
+			auto& registry = instance();
+			DeclareSection(registry.m);
+			for(auto& item : registry.histograms)
+				item.second->reset();
+		}
+		//One line per histogram, the latencies are in microseconds.
+		static std::wstring dump()
+		{
+			std::wostringstream text;
+			text << std::fixed << std::setprecision(3);
+			for(auto& item : snapshot())
+			{
+				auto& s = item.second;
+				text << item.first << L": count=" << s.count << L" mean=" << s.mean / 1000.0 << L"us p50=" << s.p50 / 1000.0
+					<< L"us p99=" << s.p99 / 1000.0 << L"us max=" << s.max / 1000.0 << L"us\n";
+			}
+			return text.str();
+		}
+	};
+};
\ No newline at end of file
@@ -25,7 +25,7 @@ namespace custom
 		template<typename Elem>
 		inline Elem operator()(Elem min, Elem max)
 		{
-			static boost::recursive_mutex m;
+			static custom::adaptive_mutex m;
 			DeclareSection(m);
 			return (Elem)(distribution()() % (max - min + 1) + min);
 		}
@@ -0,0 +1,666 @@
+/*
+	This library transcodes between UTF-8, UTF-16 and UTF-32 in a single pass, without any help of the OS, thus it works the same on all the platforms.
+	The runs of ASCII are converted 16 or 32 bytes at a time with SSE2 or AVX2, whichever the compiler targets, the rest goes through the validating scalar code.
+	The invalid sequences are replaced by U+FFFD one maximal subpart at a time, the same as MultiByteToWideChar does since Vista, thus nothing ever fails.
+
+	The output buffer must hold the worst case, given by the max_*_length functions, the functions return the number of the units written.
+	wchar_t is taken as UTF-16 where it is 2 bytes (Windows) and as UTF-32 where it is 4 bytes (Linux).
+
+	Here goes an example:
+
+	std::wstring unicode(transcode::max_wide_length_from_utf8(text.size()), L'\0');
+	unicode.resize(transcode::utf8_to_wide(text.data(), text.size(), &unicode[0]));
+
+	The streaming converters take the input chunk by chunk, cut anywhere, and carry a sequence split by the cut over to the next chunk:
+
+	transcode::utf8_to_wide_stream decoder;
+	std::vector<wchar_t> out(transcode::utf8_to_wide_stream::max_length(chunk_size));
+	while(auto size = next_chunk(chunk))
+		consume(out.data(), decoder.convert(chunk, size, out.data()));
+	consume(out.data(), decoder.finish(out.data()));	//A sequence truncated by the end of the input results in U+FFFD.
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRANSCODE_AVX2	1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#include <emmintrin.h>
+#define TRANSCODE_SSE2	1
+#endif
+
+namespace transcode
+{
+	enum : char32_t {replacement_character = 0xFFFD};
+
+	//The worst case lengths of the output in units.
+	inline size_t max_utf16_length_from_utf8(size_t size) {return size;}
+	inline size_t max_utf32_length_from_utf8(size_t size) {return size;}
+	inline size_t max_utf8_length_from_utf16(size_t size) {return size * 3;}
+	inline size_t max_utf8_length_from_utf32(size_t size) {return size * 4;}
+	inline size_t max_wide_length_from_utf8(size_t size) {return size;}
+	inline size_t max_utf8_length_from_wide(size_t size) {return 2 == sizeof(wchar_t) ? max_utf8_length_from_utf16(size) : max_utf8_length_from_utf32(size);}
+
+	//Decodes one code point and moves p past it. An invalid or truncated sequence results in U+FFFD, and p moves past its maximal subpart, at least one byte.
+	inline char32_t decode_utf8_imply(const unsigned char*& p, const unsigned char* end)
+	{
+		unsigned char lead = *p++;
+		if(lead < 0x80) return lead;
+		unsigned char low = 0x80, high = 0xBF;
+		char32_t code;
+		int count;
+		if(lead < 0xC2) return replacement_character;
+		else if(lead < 0xE0)
+		{
+			code = lead & 0x1F;
+			count = 1;
+		}
+		else if(lead < 0xF0)
+		{
+			code = lead & 0x0F;
+			count = 2;
+			//Rules out the overlong forms and the surrogates.
+			if(0xE0 == lead) low = 0xA0;
+			else if(0xED == lead) high = 0x9F;
+		}
+		else if(lead < 0xF5)
+		{
+			code = lead & 0x07;
+			count = 3;
+			//Rules out the overlong forms and the code points beyond U+10FFFF.
+			if(0xF0 == lead) low = 0x90;
+			else if(0xF4 == lead) high = 0x8F;
+		}
+		else return replacement_character;
+		for(; 0 < count; --count)
+		{
+			if(end == p || *p < low || *p > high) return replacement_character;
+			code = (code << 6) | (*p++ & 0x3F);
+			low = 0x80;
+			high = 0xBF;
+		}
+		return code;
+	}
+	//Encodes a valid code point, returns the position past it.
+	inline char* encode_utf8_imply(char32_t code, char* out)
+	{
+		if(code < 0x80)
+			*out++ = (char)code;
+		else if(code < 0x800)
+		{
+			*out++ = (char)(0xC0 | (code >> 6));
+			*out++ = (char)(0x80 | (code & 0x3F));
+		}
+		else if(code < 0x10000)
+		{
+			*out++ = (char)(0xE0 | (code >> 12));
+			*out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			*out++ = (char)(0xF0 | (code >> 18));
+			*out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+			*out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (code & 0x3F));
+		}
+		return out;
+	}
+
+	//The ASCII fast path group, each converts the leading run of ASCII as far as the whole blocks go and moves the pointers past it.
+	inline void widen_ascii_imply(const unsigned char*& p, const unsigned char* end, char16_t*& out)
+	{
+#if defined(TRANSCODE_AVX2)
+		for(; 32 <= end - p; p += 32, out += 32)
+		{
+			auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			if(0 != _mm256_movemask_epi8(block)) break;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(block)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(block, 1)));
+		}
+#elif defined(TRANSCODE_SSE2)
+		auto zero = _mm_setzero_si128();
+		for(; 16 <= end - p; p += 16, out += 16)
+		{
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if(0 != _mm_movemask_epi8(block)) break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(block, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(block, zero));
+		}
+#endif
+		(void)p; (void)end; (void)out;
+	}
+	inline void widen_ascii_imply(const unsigned char*& p, const unsigned char* end, char32_t*& out)
+	{
+#if defined(TRANSCODE_AVX2)
+		for(; 32 <= end - p; p += 32, out += 32)
+		{
+			auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			if(0 != _mm256_movemask_epi8(block)) break;
+			for(int k = 0; k < 4; ++k)
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k * 8), _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + k * 8))));
+		}
+#elif defined(TRANSCODE_SSE2)
+		auto zero = _mm_setzero_si128();
+		for(; 16 <= end - p; p += 16, out += 16)
+		{
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if(0 != _mm_movemask_epi8(block)) break;
+			auto low = _mm_unpacklo_epi8(block, zero), high = _mm_unpackhi_epi8(block, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(high, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(high, zero));
+		}
+#endif
+		(void)p; (void)end; (void)out;
+	}
+	inline void narrow_ascii_imply(const char16_t*& p, const char16_t* end, char*& out)
+	{
+#if defined(TRANSCODE_AVX2)
+		auto mask = _mm256_set1_epi16((short)0xFF80);
+		for(; 32 <= end - p; p += 32, out += 32)
+		{
+			auto low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16));
+			if(0 == _mm256_testz_si256(_mm256_or_si256(low, high), mask)) break;
+			//packus works within the 128-bit lanes, the permutation restores the order.
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8));
+		}
+#elif defined(TRANSCODE_SSE2)
+		auto mask = _mm_set1_epi16((short)0xFF80), zero = _mm_setzero_si128();
+		for(; 16 <= end - p; p += 16, out += 16)
+		{
+			auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+			if(0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(low, high), mask), zero))) break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(low, high));
+		}
+#endif
+		(void)p; (void)end; (void)out;
+	}
+	inline void narrow_ascii_imply(const char32_t*& p, const char32_t* end, char*& out)
+	{
+#if defined(TRANSCODE_SSE2)
+		auto mask = _mm_set1_epi32((int)0xFFFFFF80), zero = _mm_setzero_si128();
+		for(; 16 <= end - p; p += 16, out += 16)
+		{
+			auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+			auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+			auto any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+			if(0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, mask), zero))) break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+#endif
+		(void)p; (void)end; (void)out;
+	}
+
+	//The conversion group, the output must hold the worst case length.
+	inline size_t utf8_to_utf16(const char* text, size_t size, char16_t* out)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(text), end = p + size;
+		auto first = out;
+		while(p < end)
+		{
+			widen_ascii_imply(p, end, out);
+			//The scalar path takes the characters up to the next block which might be all ASCII.
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; )
+			{
+				if(*p < 0x80)
+				{
+					*out++ = *p++;
+					continue;
+				}
+				auto code = decode_utf8_imply(p, end);
+				if(code < 0x10000)
+					*out++ = (char16_t)code;
+				else
+				{
+					*out++ = (char16_t)(0xD7C0 + (code >> 10));
+					*out++ = (char16_t)(0xDC00 | (code & 0x3FF));
+				}
+			}
+		}
+		return out - first;
+	}
+	inline size_t utf8_to_utf32(const char* text, size_t size, char32_t* out)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(text), end = p + size;
+		auto first = out;
+		while(p < end)
+		{
+			widen_ascii_imply(p, end, out);
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; )
+				*out++ = *p < 0x80 ? *p++ : decode_utf8_imply(p, end);
+		}
+		return out - first;
+	}
+	//An unpaired surrogate results in U+FFFD.
+	inline size_t utf16_to_utf8(const char16_t* text, size_t size, char* out)
+	{
+		auto p = text, end = text + size;
+		auto first = out;
+		while(p < end)
+		{
+			narrow_ascii_imply(p, end, out);
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; )
+			{
+				char32_t code = *p++;
+				if(code < 0x80)
+				{
+					*out++ = (char)code;
+					continue;
+				}
+				if(0xD800 == (code & 0xF800))
+				{
+					if(code < 0xDC00 && p < end && 0xDC00 == (*p & 0xFC00))
+						code = 0x10000 + ((code - 0xD800) << 10) + (*p++ - 0xDC00);
+					else
+						code = replacement_character;
+				}
+				out = encode_utf8_imply(code, out);
+			}
+		}
+		return out - first;
+	}
+	//A surrogate or a value beyond U+10FFFF results in U+FFFD.
+	inline size_t utf32_to_utf8(const char32_t* text, size_t size, char* out)
+	{
+		auto p = text, end = text + size;
+		auto first = out;
+		while(p < end)
+		{
+			narrow_ascii_imply(p, end, out);
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; )
+			{
+				char32_t code = *p++;
+				if(code < 0x80)
+				{
+					*out++ = (char)code;
+					continue;
+				}
+				if(code > 0x10FFFF || 0xD800 == (code & 0xFFFFF800))
+					code = replacement_character;
+				out = encode_utf8_imply(code, out);
+			}
+		}
+		return out - first;
+	}
+
+	//The wchar_t group, which maps to UTF-16 or UTF-32 by the size of wchar_t.
+	inline size_t utf8_to_wide(const char* text, size_t size, wchar_t* out)
+	{
+		return 2 == sizeof(wchar_t) ? utf8_to_utf16(text, size, reinterpret_cast<char16_t*>(out)) : utf8_to_utf32(text, size, reinterpret_cast<char32_t*>(out));
+	}
+	inline size_t wide_to_utf8(const wchar_t* text, size_t size, char* out)
+	{
+		return 2 == sizeof(wchar_t) ? utf16_to_utf8(reinterpret_cast<const char16_t*>(text), size, out) : utf32_to_utf8(reinterpret_cast<const char32_t*>(text), size, out);
+	}
+
+	//Moves p past the leading run of ASCII as far as the whole blocks go.
+	inline void skip_ascii_imply(const unsigned char*& p, const unsigned char* end)
+	{
+#if defined(TRANSCODE_AVX2)
+		for(; 32 <= end - p && 0 == _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))); p += 32);
+#elif defined(TRANSCODE_SSE2)
+		for(; 16 <= end - p && 0 == _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); p += 16);
+#endif
+		(void)p; (void)end;
+	}
+	//The exact number of the units utf8_to_wide writes, the invalid sequences included.
+	inline size_t wide_length_from_utf8(const char* text, size_t size)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(text), end = p + size;
+		size_t length = 0;
+		while(p < end)
+		{
+			auto first = p;
+			skip_ascii_imply(p, end);
+			length += p - first;
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; ++length)
+			{
+				if(*p < 0x80)
+					++p;
+				else if(0x10000 <= decode_utf8_imply(p, end) && 2 == sizeof(wchar_t))
+					++length;
+			}
+		}
+		return length;
+	}
+	//The exact number of the bytes wide_to_utf8 writes.
+	inline size_t utf8_length_from_wide(const wchar_t* text, size_t size)
+	{
+		size_t length = 0;
+		for(auto p = text, end = text + size; p < end; ++p)
+		{
+			char32_t code = (char32_t)*p;
+			if(code < 0x80) length += 1;
+			else if(code < 0x800) length += 2;
+			else if(2 == sizeof(wchar_t) && code < 0xDC00 && 0xD800 <= code && p + 1 < end && 0xDC00 == (p[1] & 0xFC00))
+			{
+				length += 4;
+				++p;
+			}
+			else if(code < 0x10000 || code > 0x10FFFF) length += 3;
+			else length += 4;
+		}
+		return length;
+	}
+	//The validation and length group, which only reads the text, thus allocates nothing and runs close to the memory bandwidth.
+	inline int popcount_imply(uint32_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_popcount(v);
+#else
+		v = v - ((v >> 1) & 0x55555555);
+		v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+		return (int)((((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#endif
+	}
+#if defined(TRANSCODE_AVX2)
+	//The lookup algorithm of Keiser and Lemire, which checks each byte against the 3 bytes before it with 3 table lookups, 32 bytes at a time.
+	//The bits of the tables stand for the kinds of the errors, a pair of bytes is wrong if a kind is flagged by all the 3 lookups.
+	struct utf8_validator_imply
+	{
+		enum : uint8_t
+		{
+			too_short = 1 << 0,		//A lead byte not followed by a continuation byte.
+			too_long = 1 << 1,		//A continuation byte after an ASCII byte.
+			overlong_3 = 1 << 2,
+			too_large = 1 << 3,
+			surrogate = 1 << 4,
+			overlong_2 = 1 << 5,
+			too_large_1000 = 1 << 6,
+			overlong_4 = 1 << 6,
+			two_continuations = 1 << 7,
+			carry = too_short | too_long | two_continuations,
+		};
+		__m256i	error;
+		__m256i	previous;
+		__m256i	previous_incomplete;
+
+		utf8_validator_imply() : error(_mm256_setzero_si256()), previous(_mm256_setzero_si256()), previous_incomplete(_mm256_setzero_si256()) {}
+		static __m256i lookup(__m256i index, int8_t v0, int8_t v1, int8_t v2, int8_t v3, int8_t v4, int8_t v5, int8_t v6, int8_t v7, int8_t v8, int8_t v9, int8_t v10, int8_t v11, int8_t v12, int8_t v13, int8_t v14, int8_t v15)
+		{
+			return _mm256_shuffle_epi8(_mm256_setr_epi8(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15), index);
+		}
+		//The bytes shifted by n from the previous block into the current one.
+		template<int N>
+		__m256i before(__m256i input)const
+		{
+			return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+		}
+		void check(__m256i input)
+		{
+			auto low_nibbles = _mm256_set1_epi8(0x0F);
+			auto previous1 = before<1>(input);
+			auto high1 = _mm256_and_si256(_mm256_srli_epi16(previous1, 4), low_nibbles);
+			auto low1 = _mm256_and_si256(previous1, low_nibbles);
+			auto high2 = _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibbles);
+			auto special = _mm256_and_si256(_mm256_and_si256(
+				lookup(high1, too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+					(int8_t)two_continuations, (int8_t)two_continuations, (int8_t)two_continuations, (int8_t)two_continuations,
+					too_short | overlong_2, too_short, too_short | overlong_3 | surrogate, too_short | too_large | too_large_1000 | overlong_4),
+				lookup(low1, (int8_t)(carry | overlong_3 | overlong_2 | overlong_4), (int8_t)(carry | overlong_2), (int8_t)carry, (int8_t)carry,
+					(int8_t)(carry | too_large), (int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000),
+					(int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000),
+					(int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000 | surrogate), (int8_t)(carry | too_large | too_large_1000), (int8_t)(carry | too_large | too_large_1000))),
+				lookup(high2, too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+					(int8_t)(too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4), (int8_t)(too_long | overlong_2 | two_continuations | overlong_3 | too_large),
+					(int8_t)(too_long | overlong_2 | two_continuations | surrogate | too_large), (int8_t)(too_long | overlong_2 | two_continuations | surrogate | too_large),
+					too_short, too_short, too_short, too_short));
+			//The 3rd and 4th bytes of the sequences must be continuation bytes, which is where two_continuations is expected instead of an error.
+			auto third = _mm256_subs_epu8(before<2>(input), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+			auto fourth = _mm256_subs_epu8(before<3>(input), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+			auto expected = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+			error = _mm256_or_si256(error, _mm256_xor_si256(expected, special));
+		}
+		void feed(__m256i input)
+		{
+			if(0 == _mm256_movemask_epi8(input))
+				error = _mm256_or_si256(error, previous_incomplete);
+			else
+			{
+				check(input);
+				//The lead bytes in the last 3 positions need the bytes of the next block.
+				previous_incomplete = _mm256_subs_epu8(input, _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+					-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)));
+			}
+			previous = input;
+		}
+		bool valid()const
+		{
+			return _mm256_testz_si256(_mm256_or_si256(error, previous_incomplete), _mm256_or_si256(error, previous_incomplete));
+		}
+	};
+#endif
+	//Whether the text is well-formed UTF-8, which the conversion would take without any U+FFFD replacing.
+	inline bool validate_utf8(const char* text, size_t size)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(text), end = p + size;
+#if defined(TRANSCODE_AVX2)
+		utf8_validator_imply validator;
+		for(; 32 <= end - p; p += 32)
+			validator.feed(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+		if(p < end)
+		{
+			//The last partial block is padded with zeros, which are ASCII thus complete.
+			alignas(32) unsigned char last[32] = {0};
+			std::copy(p, end, last);
+			validator.feed(_mm256_load_si256(reinterpret_cast<const __m256i*>(last)));
+		}
+		return validator.valid();
+#else
+		while(p < end)
+		{
+			skip_ascii_imply(p, end);
+			for(auto stop = p + 16 < end ? p + 16 : end; p < stop; )
+			{
+				if(*p < 0x80)
+				{
+					++p;
+					continue;
+				}
+				auto first = p;
+				//U+FFFD itself is the only valid sequence decoded to U+FFFD.
+				if(replacement_character == decode_utf8_imply(p, end) && (3 != p - first || 0xEF != first[0] || 0xBF != first[1] || 0xBD != first[2]))
+					return false;
+			}
+		}
+		return true;
+#endif
+	}
+	//The number of the UTF-16 units of a well-formed UTF-8 text, which is the bytes except the continuation bytes, plus one more per 4-byte sequence.
+	//The length of an invalid text is unspecified, such a text must either be validated first or measured with wide_length_from_utf8.
+	inline size_t utf16_length_from_utf8(const char* text, size_t size)
+	{
+		auto p = reinterpret_cast<const signed char*>(text), end = p + size;
+		size_t length = 0;
+#if defined(TRANSCODE_AVX2)
+		for(; 32 <= end - p; p += 32)
+		{
+			auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			length += popcount_imply((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(block, _mm256_set1_epi8(-65))));
+			length += popcount_imply((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(block, _mm256_set1_epi8((char)0xF0)), block)));
+		}
+#elif defined(TRANSCODE_SSE2)
+		for(; 16 <= end - p; p += 16)
+		{
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			//The continuation bytes are 0x80-0xBF, which are -128 to -65 as signed. The 4-byte leads are 0xF0 and above.
+			length += popcount_imply((uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(block, _mm_set1_epi8(-65))));
+			length += popcount_imply((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8((char)0xF0)), block)));
+		}
+#endif
+		for(; p < end; ++p)
+			length += (*p > -65) + ((unsigned char)*p >= 0xF0);
+		return length;
+	}
+	//The number of the code points of a well-formed UTF-8 text, with the same caveat as utf16_length_from_utf8.
+	inline size_t utf32_length_from_utf8(const char* text, size_t size)
+	{
+		auto p = reinterpret_cast<const signed char*>(text), end = p + size;
+		size_t length = 0;
+#if defined(TRANSCODE_AVX2)
+		for(; 32 <= end - p; p += 32)
+			length += popcount_imply((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_set1_epi8(-65))));
+#elif defined(TRANSCODE_SSE2)
+		for(; 16 <= end - p; p += 16)
+			length += popcount_imply((uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_set1_epi8(-65))));
+#endif
+		for(; p < end; ++p)
+			length += *p > -65;
+		return length;
+	}
+	//The number of the UTF-8 bytes of a well-formed UTF-16 text, 1 to 3 bytes per unit, where a surrogate pair takes 2 bytes per unit.
+	//An unpaired surrogate is counted as 2 bytes, while it is converted to 3 bytes of U+FFFD, thus an unchecked text must be measured with utf8_length_from_wide.
+	inline size_t utf8_length_from_utf16(const char16_t* text, size_t size)
+	{
+		auto p = text, end = text + size;
+		size_t length = size;
+#if defined(TRANSCODE_SSE2)
+		auto zero = _mm_setzero_si128();
+		for(; 8 <= end - p; p += 8)
+		{
+			auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			auto below80 = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, _mm_set1_epi16((short)0xFF80)), zero));
+			auto below800 = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, _mm_set1_epi16((short)0xF800)), zero));
+			auto surrogates = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(block, _mm_set1_epi16((short)0xF800)), _mm_set1_epi16((short)0xD800)));
+			//Each unit sets 2 bits of the masks.
+			length += (size_t)(32 - popcount_imply((uint32_t)below80) - popcount_imply((uint32_t)below800) - popcount_imply((uint32_t)surrogates)) / 2;
+		}
+#endif
+		for(; p < end; ++p)
+			length += (*p >= 0x80) + (*p >= 0x800) - (0xD800 == (*p & 0xF800));
+		return length;
+	}
+	//The number of the UTF-8 bytes of a UTF-32 text, exact for any text since each value converts on its own.
+	inline size_t utf8_length_from_utf32(const char32_t* text, size_t size)
+	{
+		size_t length = size;
+		for(auto p = text, end = text + size; p < end; ++p)
+			length += (*p >= 0x80) + (*p >= 0x800) + (*p >= 0x10000) - (*p > 0x10FFFF);
+		return length;
+	}
+
+	//The boundary group, each moves the position forward to where the conversion of the text may be cut without changing the result,
+	//thus the pieces can be converted independently, such as on different threads.
+	inline size_t utf8_boundary(const char* text, size_t size, size_t position)
+	{
+		//A sequence never takes more than 3 continuation bytes, the 4th one is decoded on its own.
+		for(size_t k = 0; k < 4 && position < size && 0x80 == (text[position] & 0xC0); ++k)
+			++position;
+		return position;
+	}
+	inline size_t wide_boundary(const wchar_t* text, size_t size, size_t position)
+	{
+		if(2 == sizeof(wchar_t) && 0 < position && position < size && 0xD800 == (text[position - 1] & 0xFC00) && 0xDC00 == (text[position] & 0xFC00))
+			++position;
+		return position;
+	}
+
+	//The length of the trailing bytes which are a valid but incomplete sequence, 0 if the text ends with a complete or invalid sequence.
+	inline size_t utf8_incomplete_tail(const char* text, size_t size)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(text);
+		//Looks for the lead byte among the last 3 bytes, a longer tail can't be incomplete.
+		for(size_t tail = 1; tail <= 3 && tail <= size; ++tail)
+		{
+			unsigned char lead = p[size - tail];
+			if(0x80 == (lead & 0xC0)) continue;
+			size_t length = lead < 0xC2 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : lead < 0xF5 ? 4 : 1;
+			if(length <= tail) return 0;
+			//The second byte has a narrower range after some of the lead bytes.
+			if(1 < tail)
+			{
+				unsigned char second = p[size - tail + 1];
+				if((0xE0 == lead && second < 0xA0) || (0xED == lead && second > 0x9F) || (0xF0 == lead && second < 0x90) || (0xF4 == lead && second > 0x8F))
+					return 0;
+			}
+			return tail;
+		}
+		return 0;
+	}
+
+	//The streaming group, each keeps the state between the chunks, thus the memory stays constant however long the input is.
+	class utf8_to_wide_stream
+	{
+	private:
+		char	carry[4];
+		size_t	carried;
+	public:
+		utf8_to_wide_stream() : carried(0) {}
+		//The output length convert needs at most for a chunk of size bytes.
+		static size_t max_length(size_t size) {return max_wide_length_from_utf8(size + 3);}
+		//Converts the chunk into out and returns the number of the units written, the incomplete sequence at the end is held back for the next chunk.
+		size_t convert(const char* text, size_t size, wchar_t* out)
+		{
+			size_t written = 0;
+			if(0 < carried)
+			{
+				//Completes the carried sequence byte by byte, until it is either complete or proven invalid.
+				while(0 < size && carried == utf8_incomplete_tail(carry, carried))
+				{
+					carry[carried++] = *text++;
+					--size;
+				}
+				auto tail = utf8_incomplete_tail(carry, carried);
+				if(carried == tail) return 0;
+				//The byte which broke the sequence may start the next one, thus it goes back to the input.
+				text -= tail;
+				size += tail;
+				written = utf8_to_wide(carry, carried - tail, out);
+				carried = 0;
+			}
+			auto tail = utf8_incomplete_tail(text, size);
+			written += utf8_to_wide(text, size - tail, out + written);
+			std::copy(text + size - tail, text + size, carry);
+			carried = tail;
+			return written;
+		}
+		//Flushes the sequence held back at the end of the input as U+FFFD, out must hold 1 unit.
+		size_t finish(wchar_t* out)
+		{
+			size_t written = utf8_to_wide(carry, carried, out);
+			carried = 0;
+			return written;
+		}
+	};
+	class wide_to_utf8_stream
+	{
+	private:
+		wchar_t	pending;	//The high surrogate at the end of the last chunk, which only happens where wchar_t is UTF-16.
+	public:
+		wide_to_utf8_stream() : pending(0) {}
+		static size_t max_length(size_t size) {return max_utf8_length_from_wide(size + 1);}
+		size_t convert(const wchar_t* text, size_t size, char* out)
+		{
+			size_t written = 0;
+			if(0 == size) return 0;
+			if(0 != pending)
+			{
+				wchar_t pair[2] = {pending, *text};
+				bool paired = 0xDC00 == (*text & 0xFC00);
+				written = wide_to_utf8(pair, paired ? 2 : 1, out);
+				pending = 0;
+				if(paired)
+				{
+					++text;
+					--size;
+				}
+			}
+			if(2 == sizeof(wchar_t) && 0 < size && 0xD800 == (text[size - 1] & 0xFC00))
+				pending = text[--size];
+			return written + wide_to_utf8(text, size, out + written);
+		}
+		//Flushes the unpaired high surrogate held back as U+FFFD, out must hold 3 bytes.
+		size_t finish(char* out)
+		{
+			size_t written = 0 == pending ? 0 : wide_to_utf8(&pending, 1, out);
+			pending = 0;
+			return written;
+		}
+	};
+}
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <boost/tokenizer.hpp>
 #include <boost/algorithm/string.hpp>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 namespace custom
 {
@@ -12,7 +15,7 @@ namespace custom
 	{
 		using namespace boost::algorithm;
 		std::vector<StringType> results;
-		for(auto it = make_split_iterator(text, first_finder(seperator, is_equal())); split_iterator<StringType::const_iterator>() != it; ++it)
+		for(auto it = make_split_iterator(text, first_finder(seperator, is_equal())); split_iterator<typename StringType::const_iterator>() != it; ++it)
 		{
 			if(it->empty()) continue;
 			results.push_back(StringType(it->begin(), it->end()));
@@ -23,4 +26,33 @@ namespace custom
 	{
 		std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
 	}
+	//Calls f(size_t index) for each index in [0, count) on up to threads threads including the calling one, returns when all the calls have returned.
+	//The indexes are handed out in blocks of grain from a shared counter, thus the threads finishing early take over the rest.
+	template<typename Function>
+	inline void parallel_for(size_t count, Function f, size_t threads = std::thread::hardware_concurrency(), size_t grain = 64)
+	{
+		grain = (std::max)(grain, (size_t)1);
+		threads = (std::min)((std::max)(threads, (size_t)1), (count + grain - 1) / grain);
+		if(1 >= threads)
+		{
+			for(size_t k = 0; k < count; ++k)
+				f(k);
+			return;
+		}
+		std::atomic<size_t> next(0);
+		auto work = [&]()
+		{
+			for(size_t first; count > (first = next.fetch_add(grain)); )
+			{
+				for(size_t k = first, last = (std::min)(first + grain, count); k < last; ++k)
+					f(k);
+			}
+		};
+		std::vector<std::thread> workers;
+		for(size_t k = 1; k < threads; ++k)
+			workers.emplace_back(work);
+		work();
+		for(auto& worker : workers)
+			worker.join();
+	}
 }
\ No newline at end of file
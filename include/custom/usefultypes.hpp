@@ -14,13 +14,24 @@
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/date_time.hpp>
+#include <boost/mpl/if.hpp>
 #include <memory>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #define	DeclareSection(m)	auto __a7031x_custom_lock_guard = custom::generate_mutex_guard(m)
 #define	DeclareSharedSection(m)	boost::shared_lock<boost::shared_mutex> __a7031x_shared_lock_guard(const_cast<boost::shared_mutex&>(m))
 #define	DeclareUniqueSection(m)	boost::unique_lock<boost::shared_mutex> __a7031x_shared_lock_guard(const_cast<boost::shared_mutex&>(m))
-#define	PostExitGuard(f)	custom::territory_exit_guard __a7031x_custom_exit_guard(f)
+#define	PostExitGuard(f)	auto __a7031x_custom_exit_guard = custom::make_exit_guard(f)
+#define	DismissExitGuard()	__a7031x_custom_exit_guard.dismiss()
 namespace custom
 {
 	struct iless
@@ -61,34 +72,265 @@ namespace custom
 		return const_cast<Mutex&>(m);
 	}
 
-	template<typename ReturnType>
-	struct wait_wrapper_generic
+	//Tells the processor that the caller is busy waiting, so that the sibling hyper-thread gets the pipeline and the memory order violation on exit is avoided.
+	inline void cpu_relax()
 	{
-		boost::timed_mutex m;
-		boost::function<ReturnType()> f;
-		wait_wrapper_generic(boost::function<ReturnType()> _f) : f(_f) {m.lock();}
-		bool wait(uint64_t milliseconds = INT32_MAX)
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+		_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	//The statistics of the sampled lock holds, the durations are in nanoseconds.
+	struct lock_hold_statistics
+	{
+		uint64_t	samples;
+		uint64_t	long_holds;
+		uint64_t	max_hold;
+	};
+
+	//The mutex spins for a short while before parking the thread, which suits the critical sections of tens of nanoseconds far better than a kernel-backed mutex.
+	//It works with DeclareSection and custom::lock_guard just like the boost mutexes.
+	//Once enable_sampling is called, one in every interval acquisitions is timed, and the holds longer than the threshold are counted as too long for spinning.
+	class adaptive_mutex : boost::noncopyable
+	{
+	private:
+		enum {unlocked, locked, contended};
+		enum {spin_count = 256};
+		typedef std::chrono::steady_clock	clock;
+		std::atomic<int>			state;
+		boost::mutex				park_mutex;
+		boost::condition_variable	cv;
+		std::atomic<uint32_t>		sample_interval;
+		uint64_t					long_hold_threshold;
+		//The members below are only modified by the owner.
+		uint32_t					acquisitions;
+		bool						sampling;
+		clock::time_point			hold_start;
+		std::atomic<uint64_t>		samples;
+		std::atomic<uint64_t>		long_holds;
+		std::atomic<uint64_t>		max_hold;
+
+		bool acquire()
+		{
+			int expected = unlocked;
+			return state.compare_exchange_strong(expected, locked, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+		//The contended state tells the owner that somebody is parked, thus unlock needs to wake it up.
+		void acquire_slow()
 		{
-			if(m.timed_lock(boost::posix_time::milliseconds(milliseconds)))
+			for(int k = 0; k < spin_count; ++k)
 			{
-				m.unlock();
-				return true;
+				cpu_relax();
+				if(unlocked == state.load(std::memory_order_relaxed) && acquire())
+					return;
+			}
+			while(unlocked != state.exchange(contended, std::memory_order_acquire))
+			{
+				boost::unique_lock<boost::mutex> lock(park_mutex);
+				while(contended == state.load())
+					cv.wait(lock);
 			}
-			return false;
 		}
-		bool waiting()const
+		void begin_hold()
 		{
-			if(const_cast<decltype(m)&>(m).try_lock())
+			auto interval = sample_interval.load(std::memory_order_relaxed);
+			if(0 != interval && 0 == ++acquisitions % interval)
 			{
-				const_cast<decltype(m)&>(m).unlock();
+				sampling = true;
+				hold_start = clock::now();
+			}
+		}
+		void end_hold()
+		{
+			if(false == sampling) return;
+			sampling = false;
+			auto hold = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - hold_start).count();
+			samples.fetch_add(1, std::memory_order_relaxed);
+			if(hold > long_hold_threshold)
+				long_holds.fetch_add(1, std::memory_order_relaxed);
+			if(hold > max_hold.load(std::memory_order_relaxed))
+				max_hold.store(hold, std::memory_order_relaxed);
+		}
+	public:
+		adaptive_mutex() : state(unlocked), sample_interval(0), long_hold_threshold(0), acquisitions(0), sampling(false), samples(0), long_holds(0), max_hold(0) {}
+		void lock()
+		{
+			if(false == acquire())
+				acquire_slow();
+			begin_hold();
+		}
+		bool try_lock()
+		{
+			if(false == acquire())
 				return false;
+			begin_hold();
+			return true;
+		}
+		void unlock()
+		{
+			end_hold();
+			if(contended == state.exchange(unlocked, std::memory_order_release))
+			{
+				boost::lock_guard<boost::mutex> lock(park_mutex);
+				cv.notify_one();
+			}
+		}
+		//Call it before the mutex is shared among threads. An interval of 0 disables the sampling.
+		void enable_sampling(uint32_t interval = 64, uint64_t threshold_nanoseconds = 1000)
+		{
+			long_hold_threshold = threshold_nanoseconds;
+			sample_interval.store(interval);
+		}
+		lock_hold_statistics hold_statistics()const
+		{
+			lock_hold_statistics s = {samples.load(std::memory_order_relaxed), long_holds.load(std::memory_order_relaxed), max_hold.load(std::memory_order_relaxed)};
+			return s;
+		}
+	};
+
+	//The recursive variant of adaptive_mutex, the owner may lock it again without blocking itself.
+	class recursive_adaptive_mutex : boost::noncopyable
+	{
+	private:
+		adaptive_mutex					m;
+		std::atomic<std::thread::id>	owner;
+		uint32_t						depth;
+	public:
+		recursive_adaptive_mutex() : owner(std::thread::id()), depth(0) {}
+		void lock()
+		{
+			auto self = std::this_thread::get_id();
+			if(owner.load(std::memory_order_relaxed) == self)
+			{
+				++depth;
+				return;
+			}
+			m.lock();
+			owner.store(self, std::memory_order_relaxed);
+			depth = 1;
+		}
+		bool try_lock()
+		{
+			auto self = std::this_thread::get_id();
+			if(owner.load(std::memory_order_relaxed) == self)
+			{
+				++depth;
+				return true;
 			}
+			if(false == m.try_lock())
+				return false;
+			owner.store(self, std::memory_order_relaxed);
+			depth = 1;
 			return true;
 		}
+		void unlock()
+		{
+			if(0 != --depth) return;
+			owner.store(std::thread::id(), std::memory_order_relaxed);
+			m.unlock();
+		}
+		void enable_sampling(uint32_t interval = 64, uint64_t threshold_nanoseconds = 1000) {m.enable_sampling(interval, threshold_nanoseconds);}
+		lock_hold_statistics hold_statistics()const {return m.hold_statistics();}
+	};
+
+	//The one-shot completion signal of a cross-thread call.
+	//The waiters spin for a short while before parking on the condition variable, and the completing thread only takes the mutex if somebody is parked or chained.
+	class completion_signal : boost::noncopyable
+	{
+	private:
+		enum {pending, running, completed};
+		enum {spin_count = 1024};
+		std::atomic<int>						state;
+		std::atomic<int>						parked;
+		std::atomic<bool>						chained;
+		boost::mutex							m;
+		boost::condition_variable				cv;
+		std::vector<boost::function<void()>>	continuations;
+	public:
+		completion_signal() : state(pending), parked(0), chained(false) {}
+		//Claims the right to complete the signal, only the first caller succeeds.
+		bool begin()
+		{
+			int expected = pending;
+			return state.compare_exchange_strong(expected, running);
+		}
+		//Marks the signal completed, wakes the waiters and runs the continuations on the calling thread.
+		void complete()
+		{
+			state.store(completed);
+			if(0 == parked.load() && false == chained.load())
+				return;
+			std::vector<boost::function<void()>> tasks;
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				tasks.swap(continuations);
+				cv.notify_all();
+			}
+			for(auto& task : tasks)
+				task();
+		}
+		bool completed_already()const {return completed == state.load();}
+		bool wait_until(const boost::chrono::steady_clock::time_point& deadline)
+		{
+			for(int k = 0; k < spin_count; ++k)
+			{
+				if(completed_already()) return true;
+				cpu_relax();
+			}
+			++parked;
+			{
+				boost::unique_lock<boost::mutex> lock(m);
+				while(false == completed_already() && boost::cv_status::timeout != cv.wait_until(lock, deadline));
+			}
+			--parked;
+			return completed_already();
+		}
+		//Schedules f to run once the signal completes, or runs it immediately if it has completed already.
+		void then(boost::function<void()> f)
+		{
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				chained.store(true);
+				if(false == completed_already())
+				{
+					continuations.push_back(f);
+					return;
+				}
+			}
+			f();
+		}
+	};
+
+	template<typename ReturnType>
+	struct wait_wrapper_generic
+	{
+		completion_signal signal;
+		boost::function<ReturnType()> f;
+		wait_wrapper_generic(boost::function<ReturnType()> _f) : f(_f) {}
+		bool wait(uint64_t milliseconds = INT32_MAX)
+		{
+			return wait_until(boost::chrono::steady_clock::now() + boost::chrono::milliseconds(milliseconds));
+		}
+		bool wait_until(const boost::chrono::steady_clock::time_point& deadline)
+		{
+			return signal.wait_until(deadline);
+		}
+		bool waiting()const
+		{
+			return false == signal.completed_already();
+		}
+		//Releases the waiters without executing f, if the execution has not started yet.
 		void cancel()
 		{
-			if(waiting())
-				const_cast<decltype(m)&>(m).unlock();
+			if(signal.begin())
+				signal.complete();
+		}
+		//The continuation is called on the executing thread right after the completion, or the cancellation.
+		void then(boost::function<void()> continuation)
+		{
+			signal.then(continuation);
 		}
 	};
 
@@ -98,20 +340,20 @@ namespace custom
 		ReturnType result;
 		void execute()
 		{
-			if(waiting())
+			if(this->signal.begin())
 			{
-				result = f();
-				m.unlock();
+				result = this->f();
+				this->signal.complete();
 			}
 		}
 		template<typename CompatibleReturnType>
 		void execute(const CompatibleReturnType& result_overriden)
 		{
-			if(waiting())
+			if(this->signal.begin())
 			{
 				result = result_overriden;
-				f();
-				m.unlock();
+				this->f();
+				this->signal.complete();
 			}
 		}
 		wait_wrapper(boost::function<ReturnType()> _f) : wait_wrapper_generic<ReturnType>(_f) {}
@@ -120,10 +362,10 @@ namespace custom
 	{
 		void execute()
 		{
-			if(waiting())
+			if(signal.begin())
 			{
 				f();
-				m.unlock();
+				signal.complete();
 			}
 		}
 		wait_wrapper(boost::function<void()> _f) : wait_wrapper_generic<void>(_f) {}
@@ -133,7 +375,7 @@ namespace custom
 	template<typename ReturnType>
 	inline std::shared_ptr<wait_wrapper<ReturnType>> generate_wait_wrapper(boost::asio::io_service& ios, boost::function<ReturnType()> f)
 	{
-		auto waiter = make_shared<wait_wrapper<ReturnType>>(f);
+		auto waiter = std::make_shared<wait_wrapper<ReturnType>>(f);
 		auto agent = [waiter]()
 		{
 			waiter->execute();
@@ -141,6 +383,146 @@ namespace custom
 		ios.post(agent);
 		return waiter;
 	}
+	//The chained version, f is posted to the ios queue only after the predecessor completes or is cancelled.
+	template<typename ReturnType, typename PredecessorType>
+	inline std::shared_ptr<wait_wrapper<ReturnType>> generate_wait_wrapper(boost::asio::io_service& ios, boost::function<ReturnType()> f, const std::shared_ptr<wait_wrapper<PredecessorType>>& predecessor)
+	{
+		auto waiter = std::make_shared<wait_wrapper<ReturnType>>(f);
+		predecessor->then([&ios, waiter]()
+		{
+			ios.post([waiter]() {waiter->execute();});
+		});
+		return waiter;
+	}
+	//Waits for all the wrappers in [first, last) with a single deadline, returns false if any of them is still pending when it expires.
+	template<typename Iterator>
+	inline bool wait_all(Iterator first, Iterator last, uint64_t milliseconds = INT32_MAX)
+	{
+		auto deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(milliseconds);
+		for(; last != first; ++first)
+		{
+			if(false == (*first)->wait_until(deadline))
+				return false;
+		}
+		return true;
+	}
+
+	//Coalesces the small cross-thread calls posted to the ios queue, so that a whole batch of them runs in one posted task.
+	//A call is identified by its ticket instead of a wait_wrapper, and the completion of all tickets is tracked by one counter, thus no waiter or shared state is allocated per call.
+	//The call itself is still stored in a boost::function, which allocates unless the callable fits its small buffer, such as a plain function pointer or a trivially copyable functor of a pointer or two.
+	//The calls MUST NOT throw any exception. The destructor waits for all the calls posted so far.
+	class batch_dispatcher : boost::noncopyable
+	{
+	private:
+		enum {spin_count = 1024};
+		boost::asio::io_service&				ios;
+		boost::mutex							m;
+		std::vector<boost::function<void()>>	queued;
+		std::vector<boost::function<void()>>	running;
+		uint64_t								submitted;
+		bool									scheduled;
+		std::atomic<uint64_t>					finished;
+		std::atomic<int>						outstanding;
+		std::atomic<int>						parked;
+		boost::mutex							park_mutex;
+		boost::condition_variable				cv;
+
+		//Runs the queued batch, the two queues are swapped back and forth so their capacity is reused.
+		void drain()
+		{
+			uint64_t last;
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				running.swap(queued);
+				last = submitted;
+			}
+			for(auto& call : running)
+				call();
+			running.clear();
+			finished.store(last);
+			if(0 != parked.load())
+			{
+				boost::lock_guard<boost::mutex> lock(park_mutex);
+				cv.notify_all();
+			}
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				if(queued.empty())
+					scheduled = false;
+				else
+					schedule();
+			}
+			--outstanding;
+		}
+		void schedule()
+		{
+			++outstanding;
+			ios.post([this]() {drain();});
+		}
+	public:
+		batch_dispatcher(boost::asio::io_service& _ios) : ios(_ios), submitted(0), scheduled(false), finished(0), outstanding(0), parked(0) {}
+		~batch_dispatcher()
+		{
+			wait_all();
+			while(0 != outstanding.load())
+				boost::this_thread::yield();
+		}
+		//Queues the call and returns its ticket. Only the first call of a batch posts to the ios queue.
+		template<typename Function>
+		uint64_t post(Function call)
+		{
+			boost::lock_guard<boost::mutex> lock(m);
+			queued.push_back(call);
+			if(false == scheduled)
+			{
+				scheduled = true;
+				schedule();
+			}
+			return ++submitted;
+		}
+		//Queues the call whose result is stored into the caller owned variable, which must live until the ticket completes.
+		template<typename ReturnType>
+		uint64_t post(boost::function<ReturnType()> call, ReturnType& result)
+		{
+			return post([call, &result]() {result = call();});
+		}
+		//Posts the call and waits for its result.
+		template<typename ReturnType>
+		ReturnType call(boost::function<ReturnType()> f)
+		{
+			ReturnType result;
+			wait(post(f, result));
+			return result;
+		}
+		bool completed(uint64_t ticket)const {return finished.load() >= ticket;}
+		//Waits for the ticket and all the tickets before it.
+		bool wait(uint64_t ticket, uint64_t milliseconds = INT32_MAX)
+		{
+			for(int k = 0; k < spin_count; ++k)
+			{
+				if(completed(ticket)) return true;
+				cpu_relax();
+			}
+			auto deadline = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(milliseconds);
+			++parked;
+			{
+				boost::unique_lock<boost::mutex> lock(park_mutex);
+				while(false == completed(ticket) && boost::cv_status::timeout != cv.wait_until(lock, deadline));
+			}
+			--parked;
+			return completed(ticket);
+		}
+		//Waits for all the calls posted so far.
+		bool wait_all(uint64_t milliseconds = INT32_MAX)
+		{
+			uint64_t ticket;
+			{
+				boost::lock_guard<boost::mutex> lock(m);
+				ticket = submitted;
+			}
+			return wait(ticket, milliseconds);
+		}
+	};
 
 	class territory_exit_guard : boost::noncopyable
 	{
@@ -151,53 +533,321 @@ namespace custom
 		~territory_exit_guard() {m_task();}
 	};
 
+	//The exit guard keeping the callable inline, thus neither allocation nor indirect call is involved. It is what PostExitGuard generates.
+	//The task is called in the noexcept destructor, so a throwing task terminates the process just like territory_exit_guard.
+	template<typename Function>
+	class scope_exit_guard
+	{
+	private:
+		Function	m_task;
+		bool		m_active;
+	public:
+		explicit scope_exit_guard(Function task) : m_task(std::move(task)), m_active(true) {}
+		scope_exit_guard(scope_exit_guard&& other) noexcept(std::is_nothrow_move_constructible<Function>::value) : m_task(std::move(other.m_task)), m_active(other.m_active)
+		{
+			other.m_active = false;
+		}
+		scope_exit_guard(const scope_exit_guard&) = delete;
+		scope_exit_guard& operator = (const scope_exit_guard&) = delete;
+		~scope_exit_guard() noexcept
+		{
+			if(m_active)
+				m_task();
+		}
+		//Cancels the task, such as when the work guarded has been committed.
+		void dismiss() noexcept {m_active = false;}
+	};
+	template<typename Function>
+	inline scope_exit_guard<typename std::decay<Function>::type> make_exit_guard(Function&& task)
+	{
+		return scope_exit_guard<typename std::decay<Function>::type>(std::forward<Function>(task));
+	}
+
+	//The timer counts on the monotonic clock, which is immune to the wall-clock adjustments and resolves to nanoseconds where the platform allows.
 	class progress_timer
 	{
+	public:
+		typedef std::chrono::steady_clock	clock;
 	private:
-		boost::posix_time::ptime	start_time;
+		clock::time_point	start_time;
+		template<typename Duration>
+		Duration elapsed()const {return std::chrono::duration_cast<Duration>(clock::now() - start_time);}
 	public:
 		progress_timer() {reset();}
-		void reset() {start_time = now();}
-		int64_t milliseconds()const {return milliseconds(start_time);}
-		int64_t seconds()const {return seconds(start_time);}
-		int64_t minutes()const {return minutes(start_time);}
+		void reset() {start_time = clock::now();}
+		int64_t nanoseconds()const {return elapsed<std::chrono::nanoseconds>().count();}
+		int64_t microseconds()const {return elapsed<std::chrono::microseconds>().count();}
+		int64_t milliseconds()const {return elapsed<std::chrono::milliseconds>().count();}
+		int64_t seconds()const {return elapsed<std::chrono::seconds>().count();}
+		int64_t minutes()const {return elapsed<std::chrono::minutes>().count();}
+		//The wall-clock group, for the callers which keep the absolute start time.
 		static int64_t milliseconds(const boost::posix_time::ptime& start_time) {return (now() - start_time).total_milliseconds();}
 		static int64_t seconds(const boost::posix_time::ptime& start_time) {return (now() - start_time).total_seconds();}
 		static int64_t minutes(const boost::posix_time::ptime& start_time) {return seconds(start_time) / 60;}
 		static boost::posix_time::ptime now() {return boost::posix_time::microsec_clock::local_time();}
 	};
 
+	//The storage of custom::atomic for the types which fit into a hardware atomic word.
+	template<typename Type>
+	class atomic_lockfree_imply
+	{
+	private:
+		std::atomic<Type> value;
+	public:
+		atomic_lockfree_imply(const Type& v) : value(v) {}
+		Type load()const {return value.load();}
+		void store(const Type& v) {value.store(v);}
+		Type fetch_add(const Type& v) {return value.fetch_add(v);}
+		Type fetch_sub(const Type& v) {return value.fetch_sub(v);}
+		//Applies f to a copy of the value and publishes the result with a CAS loop, returns the published value.
+		template<typename Function>
+		Type update(Function f)
+		{
+			Type expected = value.load(std::memory_order_relaxed);
+			for(;;)
+			{
+				Type desired = expected;
+				f(desired);
+				if(value.compare_exchange_weak(expected, desired))
+					return desired;
+			}
+		}
+	};
+
+	//The storage of custom::atomic for the trivially copyable types larger than a hardware atomic word.
+	//Readers never block, they copy the value optimistically and retry if a writer interleaved, which is detected by the sequence number.
 	template<typename Type>
-	class atomic : boost::noncopyable
+	class atomic_seqlock_imply
+	{
+	private:
+		enum {word_count = (sizeof(Type) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t)};
+		std::atomic<uint32_t>	sequence;
+		std::atomic<uintptr_t>	words[word_count];
+
+		Type read_words()const
+		{
+			uintptr_t buffer[word_count];
+			for(size_t k = 0; k < word_count; ++k)
+				buffer[k] = words[k].load(std::memory_order_relaxed);
+			Type v;
+			memcpy(&v, buffer, sizeof(Type));
+			return v;
+		}
+		void write_words(const Type& v)
+		{
+			uintptr_t buffer[word_count] = {0};
+			memcpy(buffer, &v, sizeof(Type));
+			for(size_t k = 0; k < word_count; ++k)
+				words[k].store(buffer[k], std::memory_order_relaxed);
+		}
+		//The writers are serialized by turning the sequence number odd, the readers spin while it is odd.
+		uint32_t lock_writer()
+		{
+			uint32_t s = sequence.load(std::memory_order_relaxed);
+			while(0 != (s & 1) || false == sequence.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				cpu_relax();
+				s = sequence.load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_release);
+			return s + 1;
+		}
+		void unlock_writer(uint32_t s)
+		{
+			sequence.store(s + 1, std::memory_order_release);
+		}
+	public:
+		atomic_seqlock_imply(const Type& v) : sequence(0)
+		{
+			write_words(v);
+		}
+		Type load()const
+		{
+			for(;;)
+			{
+				uint32_t s = sequence.load(std::memory_order_acquire);
+				if(0 == (s & 1))
+				{
+					Type v = read_words();
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if(sequence.load(std::memory_order_relaxed) == s)
+						return v;
+				}
+				cpu_relax();
+			}
+		}
+		void store(const Type& v)
+		{
+			auto s = lock_writer();
+			write_words(v);
+			unlock_writer(s);
+		}
+		template<typename Function>
+		Type update(Function f)
+		{
+			auto s = lock_writer();
+			Type v = read_words();
+			f(v);
+			write_words(v);
+			unlock_writer(s);
+			return v;
+		}
+	};
+
+	//The storage of custom::atomic for the other types, guarded by a shared mutex.
+	template<typename Type>
+	class atomic_mutex_imply
 	{
 	private:
 		Type value;
 		boost::shared_mutex m;
 	public:
-		atomic() {}
-		atomic(const Type& v) : value(v) {}
-		operator Type()const
+		atomic_mutex_imply(const Type& v) : value(v) {}
+		Type load()const
 		{
 			DeclareSharedSection(m);
 			return value;
 		}
+		void store(const Type& v)
+		{
+			DeclareUniqueSection(m);
+			value = v;
+		}
+		template<typename Function>
+		Type update(Function f)
+		{
+			DeclareUniqueSection(m);
+			f(value);
+			return value;
+		}
+	};
+
+	//The atomic value of arbitrary type. The implementation is chosen by the type:
+	//	1. The trivially copyable types of 1, 2, 4 or 8 bytes use the hardware atomics, += and -= of integers go to fetch_add/fetch_sub, the others go to a CAS loop.
+	//	2. The other trivially copyable types use a sequence lock, thus reading never blocks.
+	//	3. All the rest use a shared mutex.
+	template<typename Type>
+	class atomic
+	{
+	public:
+		enum
+		{
+			is_trivial = std::is_trivially_copyable<Type>::value && std::is_default_constructible<Type>::value,
+			is_lock_free = is_trivial && sizeof(Type) <= sizeof(uint64_t) && 0 == (sizeof(Type) & (sizeof(Type) - 1)),
+		};
+	private:
+		typedef typename boost::mpl::if_c<is_lock_free, atomic_lockfree_imply<Type>,
+			typename boost::mpl::if_c<is_trivial, atomic_seqlock_imply<Type>, atomic_mutex_imply<Type>>::type>::type imply_type;
+		template<typename OprandType>
+		struct can_fetch_add : std::integral_constant<bool, is_lock_free && std::is_integral<Type>::value && false == std::is_same<Type, bool>::value && std::is_integral<OprandType>::value> {};
+
+		imply_type imply;
+
+		template<typename OprandType>
+		Type add(const OprandType& v, std::true_type) {return (Type)(imply.fetch_add((Type)v) + (Type)v);}
+		template<typename OprandType>
+		Type add(const OprandType& v, std::false_type) {return imply.update([&v](Type& value) {value += v;});}
+		template<typename OprandType>
+		Type sub(const OprandType& v, std::true_type) {return (Type)(imply.fetch_sub((Type)v) - (Type)v);}
+		template<typename OprandType>
+		Type sub(const OprandType& v, std::false_type) {return imply.update([&v](Type& value) {value -= v;});}
+	public:
+		atomic() : imply(Type()) {}
+		atomic(const Type& v) : imply(v) {}
+		atomic(const atomic& other) : imply(other.load()) {}
+		Type load()const {return imply.load();}
+		operator Type()const {return imply.load();}
+
+		Type operator = (const atomic& other) {return *this = other.load();}
+		template<typename OprandType>
+		Type operator = (const OprandType& v)
+		{
+			const Type value = static_cast<Type>(v);
+			imply.store(value);
+			return value;
+		}
+		template<typename OprandType>
+		Type operator += (const OprandType& v) {return add(v, can_fetch_add<OprandType>());}
+		template<typename OprandType>
+		Type operator -= (const OprandType& v) {return sub(v, can_fetch_add<OprandType>());}
 
 #define Operator(op)\
 		template<typename OprandType>\
 		Type operator op (const OprandType& v)\
 		{\
-			DeclareUniqueSection(m);\
-			value op v;\
-			return value;\
+			return imply.update([&v](Type& value) {value op v;});\
 		}
-		Operator(=)
-		Operator(+=)
-		Operator(-=)
 		Operator(*=)
 		Operator(/=)
 #undef Operator
 	};
 
+	//The counter for the statistics which are updated by many threads but seldom read.
+	//Each thread adds to its own cache-line-padded cell so that the updates never bounce a cache line, while reading sums up all the cells.
+	//The stripe count defaults to the hardware concurrency rounded up to a power of two; threads beyond it share the cells round-robin.
+	//Unlike custom::atomic, the operators don't return the new value, since producing it would require reading all the cells.
+	template<typename Type = int64_t, size_t CacheLine = 64>
+	class striped_counter : boost::noncopyable
+	{
+		static_assert(std::is_integral<Type>::value, "striped_counter requires an integral type.");
+	private:
+		struct cell
+		{
+			std::atomic<Type>	value;
+			char				padding[CacheLine - sizeof(std::atomic<Type>)];
+		};
+		size_t					mask;
+		std::unique_ptr<char[]>	buffer;
+		cell*					cells;
+
+		//Threads are numbered in the order they first touch any striped_counter of this type.
+		static size_t thread_slot()
+		{
+			static std::atomic<size_t> next(0);
+			static thread_local size_t slot = next++;
+			return slot;
+		}
+		std::atomic<Type>& local()
+		{
+			return cells[thread_slot() & mask].value;
+		}
+	public:
+		striped_counter(const Type& v = Type(), size_t stripes = boost::thread::hardware_concurrency())
+		{
+			size_t count = 1;
+			while(count < stripes) count <<= 1;
+			mask = count - 1;
+			buffer.reset(new char[count * sizeof(cell) + CacheLine]);
+			cells = reinterpret_cast<cell*>((reinterpret_cast<uintptr_t>(buffer.get()) + CacheLine - 1) & ~(uintptr_t)(CacheLine - 1));
+			for(size_t k = 0; k < count; ++k)
+				new(&cells[k]) cell();
+			*this = v;
+		}
+		size_t stripes()const {return mask + 1;}
+		//The sum of all the cells. Concurrent updates may or may not be counted.
+		Type load()const
+		{
+			Type sum = 0;
+			for(size_t k = 0; k <= mask; ++k)
+				sum += cells[k].value.load(std::memory_order_relaxed);
+			return sum;
+		}
+		operator Type()const {return load();}
+		//Resetting is not atomic with respect to the concurrent updates.
+		void operator = (const Type& v)
+		{
+			for(size_t k = 1; k <= mask; ++k)
+				cells[k].value.store(0, std::memory_order_relaxed);
+			cells[0].value.store(v, std::memory_order_relaxed);
+		}
+		template<typename OprandType>
+		void operator += (const OprandType& v) {local().fetch_add((Type)v, std::memory_order_relaxed);}
+		template<typename OprandType>
+		void operator -= (const OprandType& v) {local().fetch_sub((Type)v, std::memory_order_relaxed);}
+		void operator ++ () {*this += 1;}
+		void operator -- () {*this -= 1;}
+	};
+
 	template<template<class, class, class, class> class Map1, template<class, class, class, class> class Map2,
 		typename Tk, typename Tv1, typename Tv2, typename Less1, typename Less2, typename A1, typename A2>
 		const Map1<Tk, Tv1, Less1, A1>& operator |= (Map1<Tk, Tv1, Less1, A1>& m1, const Map2<Tk, Tv2, Less2, A2>& m2)